@@ -26,14 +26,173 @@
 #include <linux/of.h>
 #include <linux/interrupt.h>
 #include <linux/of_gpio.h>
+#include <linux/property.h>
 #include <linux/delay.h>
 #include <linux/input.h>
+#include <linux/input/matrix_keypad.h>
 #include <linux/workqueue.h>
-
-#define BBQ10_DEBUG 1
-
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define CREATE_TRACE_POINTS
+#include "bbq10_trace.h"
+
+#define ECHODEV_REG_ADDR_DEVICE_ID 0x00
 #define ECHODEV_REG_ADDR_READ_KEYBOARD 0x10
+#define ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_COUNT 0x11
+#define ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_OVERFLOW 0x12
+#define ECHODEV_REG_ADDR_KEYBOARD_MODE 0x13
 #define ECHODEV_REG_ADDR_READ_TRACKBALL 0x20
+#define ECHODEV_REG_ADDR_READ_TRACKBALL_REPORT 0x21
+#define ECHODEV_REG_ADDR_TRACKBALL_FORMAT 0x22
+#define ECHODEV_REG_ADDR_READ_EVENTS 0x30
+#define ECHODEV_REG_ADDR_READ_EVENTS_TS 0x31
+#define ECHODEV_REG_ADDR_STREAM_CONFIG 0x32
+#define ECHODEV_REG_ADDR_READ_INT_STATUS 0x40
+#define ECHODEV_REG_ADDR_INT_CONFIG 0x41
+#define ECHODEV_REG_ADDR_READ_PROFILE 0x60
+#define ECHODEV_REG_ADDR_READ_PROFILE_INFO 0x6F
+
+/* Must match KEY_FIFO_SIZE in the STM32 firmware */
+#define BBQ10_KEY_FIFO_SIZE 64
+
+/* KEYBOARD_MODE register values */
+#define BBQ10_KEYBOARD_MODE_ASCII 0
+#define BBQ10_KEYBOARD_MODE_RAW 1
+
+/* Raw mode matrix geometry and event encoding, see keyboard.h in the STM32 firmware */
+#define BBQ10_MATRIX_ROWS 7
+#define BBQ10_MATRIX_COLS 5
+#define BBQ10_MATRIX_ROW_SHIFT 3 /* get_count_order(BBQ10_MATRIX_COLS) */
+#define BBQ10_RAW_PRESSED 0x80
+#define BBQ10_RAW_CODE_MASK 0x7F
+
+/* Event burst layout, see i2c_slave.h in the STM32 firmware */
+#define BBQ10_EVENT_BURST_MAX 6
+#define BBQ10_EVENT_RECORD_SIZE 5
+#define BBQ10_EVENT_BURST_SIZE (1 + BBQ10_EVENT_BURST_MAX * BBQ10_EVENT_RECORD_SIZE)
+#define BBQ10_EVENT_HDR_MORE 0x80
+#define BBQ10_EVENT_HDR_OVERFLOW 0x40 /* the firmware dropped keys since the last burst */
+#define BBQ10_EVENT_HDR_COUNT_MASK 0x3F
+#define BBQ10_EVENT_TYPE_KEY 0x01
+#define BBQ10_EVENT_TYPE_MOTION 0x02
+#define BBQ10_EVENT_TYPE_BUTTON 0x03
+/* Timestamped burst: header, 4-byte device time, records followed by a 4-byte event time */
+#define BBQ10_EVENT_TS_BURST_MAX 3
+#define BBQ10_EVENT_TS_RECORD_SIZE (BBQ10_EVENT_RECORD_SIZE + 4)
+#define BBQ10_EVENT_TS_BURST_SIZE (5 + BBQ10_EVENT_TS_BURST_MAX * BBQ10_EVENT_TS_RECORD_SIZE)
+/* Upper bound on bursts per interrupt, the key FIFO drains in 22 timestamped ones */
+#define BBQ10_EVENT_MAX_BURSTS 24
+/*
+ * The device time is latched when the read phase starts, 3 of the 35 bytes on the wire
+ * (address, register, address) into the transfer, at a fixed bus rate. A stream read has
+ * no register phase, the latch is 1 of 33 bytes in.
+ */
+#define BBQ10_EVENT_TS_LATCH_NUM 3
+#define BBQ10_EVENT_TS_LATCH_DEN 35
+#define BBQ10_EVENT_TS_STREAM_LATCH_NUM 1
+#define BBQ10_EVENT_TS_STREAM_LATCH_DEN 33
+/* Firmware times older than this are treated as stale and clamped */
+#define BBQ10_EVENT_TS_MAX_AGE_US USEC_PER_SEC
+
+/* Versioned trackball report: version, dx, dy (big-endian), button bitmap, flags */
+#define BBQ10_TRACKBALL_REPORT_VERSION 1
+#define BBQ10_TRACKBALL_REPORT_SIZE 7
+#define BBQ10_TRACKBALL_FORMAT_BUTTONS 1
+#define BBQ10_BUTTON_LEFT 0x01
+#define BBQ10_FLAG_BUTTONS 0x01 /* the report is a button change without motion */
+/* Button changes waiting for the work, a press and release per legacy click */
+#define BBQ10_BUTTON_FIFO_SIZE 8
+
+/* Firmware profile registers, see profile.h in the STM32 firmware */
+#define BBQ10_PROFILE_REG_SIZE 16
+#define BBQ10_PROFILE_INFO_SIZE 5
+
+/* DEVICE_ID, FW_VERSION and CAPABILITIES, read in one auto-increment transfer */
+#define BBQ10_ID_SIZE 5
+#define BBQ10_DEVICE_ID 0xB1
+#define BBQ10_CAP_STREAM 0x0080
+#define BBQ10_CAP_BUTTONS 0x0100
+
+/* INT_STATUS bits and INT_CONFIG values, see host_irq.h in the STM32 firmware */
+#define BBQ10_INT_STATUS_KEY 0x01
+#define BBQ10_INT_STATUS_TRACKBALL 0x02
+#define BBQ10_INT_CONFIG_PULSE 0
+#define BBQ10_INT_CONFIG_LEVEL 1
+/* Upper bound on status polls per level interrupt */
+#define BBQ10_LEVEL_IRQ_MAX_LOOPS 8
+/* Failed INT_STATUS reads in a row before the level IRQ is masked, and how long for */
+#define BBQ10_LEVEL_IRQ_MAX_ERRORS 4
+#define BBQ10_LEVEL_IRQ_RETRY_MS 100
+
+static bool event_fifo = true;
+module_param(event_fifo, bool, 0444);
+MODULE_PARM_DESC(event_fifo, "Drain keys and trackball reports through the event FIFO register in one transaction per burst (default: true)");
+
+static bool fw_timestamps = true;
+module_param(fw_timestamps, bool, 0444);
+MODULE_PARM_DESC(fw_timestamps, "With event_fifo, stamp events with the firmware capture time instead of the interrupt time (default: true)");
+
+static bool stream_read = true;
+module_param(stream_read, bool, 0444);
+MODULE_PARM_DESC(stream_read, "With event_fifo, fetch bursts with a plain read that skips the register write, if the firmware supports it (default: true)");
+
+/* Smoothing timer rate limits */
+#define BBQ10_SMOOTH_MAX_HZ 1000
+/* Motion is kept in Q24.8 while it is spread over smoothing frames */
+#define BBQ10_MOTION_Q8 256
+
+static unsigned int smooth_hz;
+module_param(smooth_hz, uint, 0444);
+MODULE_PARM_DESC(smooth_hz, "Spread trackball motion over frames of an hrtimer at this rate, e.g. the display refresh; 0 reports each delta in one frame (default: 0)");
+
+static bool level_irq;
+module_param(level_irq, bool, 0444);
+MODULE_PARM_DESC(level_irq, "Use a single active-high interrupt (1st irq gpio) and the INT_STATUS register (default: false)");
+
+/* Where decoded events are reported to the input core */
+#define BBQ10_REPORT_IRQ_THREAD 0 /* in the threaded IRQ handler that fetched them */
+#define BBQ10_REPORT_HIGHPRI_WQ 1 /* on a dedicated WQ_HIGHPRI ordered workqueue */
+#define BBQ10_REPORT_SYSTEM_WQ 2 /* on the shared system workqueue */
+
+static int report_policy = BBQ10_REPORT_IRQ_THREAD;
+module_param(report_policy, int, 0444);
+MODULE_PARM_DESC(report_policy, "0 = report from the IRQ thread, 1 = high priority ordered workqueue, 2 = system workqueue (default: 0)");
+
+/* Key byte as read from the firmware, stamped with the hard IRQ time of its interrupt */
+struct bbq10_key_event {
+    ktime_t time;
+    u8 val;
+};
+
+/* Button change with the motion that arrived before it, so the two are reported in order */
+struct bbq10_button_event {
+    ktime_t time;
+    ktime_t motion_time;
+    s32 dx, dy;
+    u8 buttons;
+};
+
+/* IRQ to input_sync latency histogram, bucket n counts [2^(n-1), 2^n) microseconds */
+#define BBQ10_LATENCY_BUCKETS 20
+
+/* Exposed read-only in debugfs, updated without locking as they are statistics only */
+struct bbq10_stats {
+    u32 irqs;
+    u32 key_events;
+    u32 motion_reports;
+    u32 clicks;
+    u32 i2c_errors;
+    u32 key_drops; /* driver key fifo full */
+    u32 fw_key_drops; /* firmware key FIFO overflow */
+    u32 motion_coalesced; /* reports merged into motion not reported yet */
+    u32 latency_hist[BBQ10_LATENCY_BUCKETS];
+};
 
 struct bbq10_data {
     struct i2c_client *client;
@@ -42,9 +201,30 @@ struct bbq10_data {
     struct input_dev *mouse_input;
     struct work_struct key_work;
     struct work_struct trackball_work;
+    struct delayed_work irq_retry_work; /* level_irq=1: unmasks the IRQ after failed reads */
+    unsigned int irq_read_errors; /* level_irq=1: failed INT_STATUS reads in a row */
+    struct workqueue_struct *wq; /* BBQ10_REPORT_HIGHPRI_WQ only */
     int irq[2];
-    u8 key_value;
-    u8 trackball_value[4];
+    ktime_t irq_time[2]; /* captured by the hard IRQ handler, per line */
+    DECLARE_KFIFO(key_fifo, struct bbq10_key_event, BBQ10_KEY_FIFO_SIZE);
+    u8 fw_key_overflow;
+    bool raw_mode; /* linux,keymap present: firmware streams (row, col, pressed) events */
+    u16 fw_version; /* major << 8 | minor, 0 for firmware without a register file */
+    u16 fw_caps; /* CAPABILITIES register bits */
+    bool stream; /* bare reads return the event burst, see bbq10_setup_stream() */
+    bool buttons; /* firmware reports button press and release instead of clicks */
+    struct mutex event_lock; /* both IRQ threads may drain the event FIFO */
+    spinlock_t motion_lock; /* IRQ thread adds motion, work and smoothing timer consume it */
+    s32 motion_dx, motion_dy; /* fetched but not reported yet */
+    DECLARE_KFIFO(button_fifo, struct bbq10_button_event, BBQ10_BUTTON_FIFO_SIZE);
+    struct hrtimer smooth_timer;
+    ktime_t smooth_period;
+    s32 smooth_dx_q8, smooth_dy_q8; /* smoothing: motion still to be spread */
+    bool smooth_armed; /* smoothing timer started and not finished, under motion_lock */
+    s32 residue_dx_q8, residue_dy_q8; /* sub-unit remainder carried to the next frame */
+    ktime_t motion_time; /* hard IRQ time of the oldest unreported motion */
+    struct bbq10_stats stats;
+    struct dentry *debugfs;
 };
 
 static const unsigned short alphabet[] = {
@@ -143,18 +323,70 @@ static unsigned short bbq10_char_to_keycode(u8 ch, bool *needs_shift)
     }
 }
 
-/* Keyboard work handler */
-static void bbq10_key_work_handler(struct work_struct *work)
+static int bbq10_read_byte(struct bbq10_data *data, u8 reg)
+{
+    int ret = i2c_smbus_read_byte_data(data->client, reg);
+
+    trace_bbq10_i2c_read(reg, 1, ret);
+    if (ret < 0)
+        data->stats.i2c_errors++;
+
+    return ret;
+}
+
+static int bbq10_read_block(struct bbq10_data *data, u8 reg, u8 len, u8 *buf)
+{
+    int ret = i2c_smbus_read_i2c_block_data(data->client, reg, len, buf);
+
+    trace_bbq10_i2c_read(reg, len, ret);
+    if (ret != len)
+        data->stats.i2c_errors++;
+
+    return ret;
+}
+
+/* Plain read without a register phase, the firmware answers with the STREAM_CONFIG register */
+static int bbq10_read_stream(struct bbq10_data *data, u8 reg, u8 len, u8 *buf)
+{
+    int ret = i2c_master_recv(data->client, buf, len);
+
+    trace_bbq10_i2c_read(reg, len, ret);
+    if (ret != len)
+        data->stats.i2c_errors++;
+
+    return ret;
+}
+
+/* input_sync() with tracing and latency accounting, time is when the IRQ line was raised (0 = unknown) */
+static void bbq10_sync(struct bbq10_data *data, struct input_dev *input, ktime_t time)
+{
+    s64 latency_ns = time ? ktime_to_ns(ktime_sub(ktime_get(), time)) : 0;
+
+    input_sync(input);
+
+    trace_bbq10_input_sync(input == data->kbd_input ? BBQ10_INPUT_KEYBOARD : BBQ10_INPUT_TRACKBALL,
+                           latency_ns);
+
+    if (time)
+        data->stats.latency_hist[min_t(int, fls64(div_u64(latency_ns, NSEC_PER_USEC)),
+                                       BBQ10_LATENCY_BUCKETS - 1)]++;
+}
+
+/* Stamp the frame with the hard IRQ time rather than the time it is reported */
+static void bbq10_sync_at(struct bbq10_data *data, struct input_dev *input, ktime_t time)
+{
+    input_set_timestamp(input, time);
+    bbq10_sync(data, input, time);
+}
+
+/* ASCII mode: press and release in back-to-back frames, nothing here may sleep */
+static void bbq10_report_char(struct bbq10_data *data, u8 val, ktime_t time)
 {
-    struct bbq10_data *data = container_of(work, struct bbq10_data, key_work);
     unsigned short keycode;
     bool needs_shift;
-    u8 val = data->key_value;
 
-#ifdef BBQ10_DEBUG
-    pr_info("bbq10_driver: processing key 0x%02x ('%c')\n", 
+    dev_dbg(&data->client->dev, "processing key 0x%02x ('%c')\n",
             val, (val >= 32 && val < 127) ? val : '?');
-#endif
 
     /* Get keycode and shift requirement */
     keycode = bbq10_char_to_keycode(val, &needs_shift);
@@ -164,51 +396,397 @@ static void bbq10_key_work_handler(struct work_struct *work)
         return;
     }
 
-#ifdef BBQ10_DEBUG
-    pr_info("bbq10_driver: keycode=%d, needs_shift=%d\n", keycode, needs_shift);
-#endif
+    dev_dbg(&data->client->dev, "keycode=%d, needs_shift=%d\n", keycode, needs_shift);
 
-    /* Press shift if needed */
-    if (needs_shift) {
+    /* Press shift if needed, together with the key */
+    if (needs_shift)
         input_report_key(data->kbd_input, KEY_LEFTSHIFT, 1);
-        input_sync(data->kbd_input);
+    input_report_key(data->kbd_input, keycode, 1);
+    bbq10_sync_at(data, data->kbd_input, time);
+
+    /* Release the key and shift in the next frame */
+    input_report_key(data->kbd_input, keycode, 0);
+    if (needs_shift)
+        input_report_key(data->kbd_input, KEY_LEFTSHIFT, 0);
+    bbq10_sync_at(data, data->kbd_input, time);
+}
+
+/* Raw mode: decode a matrix event through the keymap, the input core handles repeat */
+static void bbq10_report_scancode(struct bbq10_data *data, u8 val, ktime_t time)
+{
+    struct input_dev *input = data->kbd_input;
+    const unsigned short *keymap = input->keycode;
+    unsigned int idx = (val & BBQ10_RAW_CODE_MASK) - 1;
+    unsigned int row = idx / BBQ10_MATRIX_COLS;
+    unsigned int col = idx % BBQ10_MATRIX_COLS;
+    unsigned int code;
+    bool pressed = val & BBQ10_RAW_PRESSED;
+
+    if (row >= BBQ10_MATRIX_ROWS) {
+        pr_err("bbq10_driver: invalid raw key event 0x%02x\n", val);
+        return;
     }
 
-    /* Press and release the key */
-    input_report_key(data->kbd_input, keycode, 1);  /* Press */
-    input_sync(data->kbd_input);
-    
-    usleep_range(8000, 10000);
-    
-    input_report_key(data->kbd_input, keycode, 0);  /* Release */
-    input_sync(data->kbd_input);
+    code = MATRIX_SCAN_CODE(row, col, BBQ10_MATRIX_ROW_SHIFT);
 
-    /* Release shift if it was pressed */
-    if (needs_shift) {
-        input_report_key(data->kbd_input, KEY_LEFTSHIFT, 0);
-        input_sync(data->kbd_input);
+    dev_dbg(&data->client->dev, "raw key row=%u col=%u pressed=%d keycode=%d\n",
+            row, col, pressed, keymap[code]);
+
+    input_event(input, EV_MSC, MSC_SCAN, code);
+    input_report_key(input, keymap[code], pressed);
+    bbq10_sync_at(data, input, time);
+}
+
+/* Keyboard work handler */
+static void bbq10_key_work_handler(struct work_struct *work)
+{
+    struct bbq10_data *data = container_of(work, struct bbq10_data, key_work);
+    struct bbq10_key_event ev;
+
+    while (kfifo_get(&data->key_fifo, &ev)) {
+        if (data->raw_mode)
+            bbq10_report_scancode(data, ev.val, ev.time);
+        else
+            bbq10_report_char(data, ev.val, ev.time);
     }
 }
 
-static irqreturn_t bbq10_keyboard_irq_handler(int irq, void *dev_id)
+/* IRQ thread side, the work handler is the only consumer */
+static void bbq10_queue_key(struct bbq10_data *data, u8 val, ktime_t time)
+{
+    struct bbq10_key_event ev = { .time = time, .val = val };
+
+    data->stats.key_events++;
+    if (!kfifo_put(&data->key_fifo, ev)) {
+        data->stats.key_drops++;
+        pr_err("bbq10_driver: key fifo full, dropping 0x%02x\n", val);
+    }
+}
+
+/* IRQ thread side, coalesces motion into the pending motion */
+static void bbq10_queue_motion(struct bbq10_data *data, s16 dx, s16 dy, ktime_t time)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&data->motion_lock, flags);
+    /* The oldest unreported motion sets the time */
+    if (!data->motion_dx && !data->motion_dy)
+        data->motion_time = time;
+    else
+        data->stats.motion_coalesced++;
+    data->motion_dx += dx;
+    data->motion_dy += dy;
+    data->stats.motion_reports++;
+    spin_unlock_irqrestore(&data->motion_lock, flags);
+}
+
+/*
+ * IRQ thread side, button changes are kept in order so a press and release are never
+ * merged. The motion pending so far goes with the change and is reported before it.
+ */
+static void bbq10_queue_buttons(struct bbq10_data *data, u8 buttons, ktime_t time)
+{
+    struct bbq10_button_event ev = { .time = time, .buttons = buttons };
+    unsigned long flags;
+
+    spin_lock_irqsave(&data->motion_lock, flags);
+    if (buttons & BBQ10_BUTTON_LEFT)
+        data->stats.clicks++;
+
+    if (kfifo_is_full(&data->button_fifo)) {
+        spin_unlock_irqrestore(&data->motion_lock, flags);
+        pr_err("bbq10_driver: button fifo full, dropping 0x%02x\n", buttons);
+        return;
+    }
+
+    ev.motion_time = data->motion_time;
+    ev.dx = data->motion_dx;
+    ev.dy = data->motion_dy;
+    data->motion_dx = 0;
+    data->motion_dy = 0;
+    kfifo_put(&data->button_fifo, ev);
+    spin_unlock_irqrestore(&data->motion_lock, flags);
+}
+
+/* Legacy 4-byte report, the all 0xFF marker is a click without a release edge */
+static void bbq10_queue_trackball(struct bbq10_data *data, const u8 *buf, ktime_t time)
+{
+    if (buf[0] == 0xFF && buf[1] == 0xFF && buf[2] == 0xFF && buf[3] == 0xFF) {
+        bbq10_queue_buttons(data, BBQ10_BUTTON_LEFT, time);
+        bbq10_queue_buttons(data, 0, time);
+        return;
+    }
+
+    bbq10_queue_motion(data, (s16)((buf[0] << 8) | buf[1]), (s16)((buf[2] << 8) | buf[3]), time);
+}
+
+static void bbq10_check_key_overflow(struct bbq10_data *data)
 {
-    struct bbq10_data *data = dev_id;
     int ret;
 
-    ret = i2c_smbus_read_byte_data(data->client, ECHODEV_REG_ADDR_READ_KEYBOARD);
-    if (ret < 0) {
-        pr_err("bbq10_driver: i2c_smbus_read_byte_data failed, ret=%d\n", ret);
-        return IRQ_HANDLED;
+    ret = bbq10_read_byte(data, ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_OVERFLOW);
+    if (ret > data->fw_key_overflow) {
+        data->stats.fw_key_drops += ret - data->fw_key_overflow;
+        pr_warn("bbq10_driver: firmware dropped %d keys\n", ret - data->fw_key_overflow);
+        data->fw_key_overflow = ret;
+    }
+}
+
+/* Report now from the IRQ thread or defer, depending on report_policy. The handlers never sleep. */
+static void bbq10_dispatch(struct bbq10_data *data, struct work_struct *work)
+{
+    switch (report_policy) {
+    case BBQ10_REPORT_IRQ_THREAD:
+        work->func(work);
+        break;
+    case BBQ10_REPORT_HIGHPRI_WQ:
+        queue_work(data->wq, work);
+        break;
+    default:
+        schedule_work(work);
+        break;
     }
+}
 
-    data->key_value = ret;
+static u32 bbq10_be32(const u8 *buf)
+{
+    return ((u32)buf[0] << 24) | ((u32)buf[1] << 16) | ((u32)buf[2] << 8) | buf[3];
+}
 
-    /* Schedule work to process the key */
-    schedule_work(&data->key_work);
+/* Map a firmware timebase value onto the host clock, relative to a burst read at ref */
+static ktime_t bbq10_fw_time(ktime_t ref, u32 dev_now, u32 dev_event)
+{
+    u32 age = dev_now - dev_event;
+
+    return ktime_sub_us(ref, min_t(u32, age, BBQ10_EVENT_TS_MAX_AGE_US));
+}
+
+/*
+ * Drain keys and the pending trackball report, a few per transaction. With fw_timestamps
+ * every record carries the firmware time it was captured at, otherwise time is used.
+ */
+static void bbq10_drain_events(struct bbq10_data *data, ktime_t time)
+{
+    u8 buf[BBQ10_EVENT_TS_BURST_SIZE];
+    u8 reg = fw_timestamps ? ECHODEV_REG_ADDR_READ_EVENTS_TS : ECHODEV_REG_ADDR_READ_EVENTS;
+    int size = fw_timestamps ? BBQ10_EVENT_TS_BURST_SIZE : BBQ10_EVENT_BURST_SIZE;
+    int max = fw_timestamps ? BBQ10_EVENT_TS_BURST_MAX : BBQ10_EVENT_BURST_MAX;
+    int stride = fw_timestamps ? BBQ10_EVENT_TS_RECORD_SIZE : BBQ10_EVENT_RECORD_SIZE;
+    int first = fw_timestamps ? 5 : 1;
+    bool keys = false, trackball = false, overflow = false;
+    ktime_t t0, t1, ref = 0;
+    u32 dev_now = 0;
+    int burst;
+    int ret;
+    int i;
+
+    mutex_lock(&data->event_lock);
+
+    for (burst = 0; burst < BBQ10_EVENT_MAX_BURSTS; burst++) {
+        t0 = ktime_get();
+        if (data->stream)
+            ret = bbq10_read_stream(data, reg, size, buf);
+        else
+            ret = bbq10_read_block(data, reg, size, buf);
+        t1 = ktime_get();
+        if (ret < 0) {
+            pr_err("bbq10_driver: event burst read failed, ret=%d\n", ret);
+            break;
+        }
+
+        if (ret != size) {
+            pr_err("bbq10_driver: expected %d bytes, got %d\n", size, ret);
+            break;
+        }
+
+        if (fw_timestamps) {
+            if (data->stream)
+                ref = ktime_add_ns(t0, ktime_to_ns(ktime_sub(t1, t0)) *
+                                   BBQ10_EVENT_TS_STREAM_LATCH_NUM / BBQ10_EVENT_TS_STREAM_LATCH_DEN);
+            else
+                ref = ktime_add_ns(t0, ktime_to_ns(ktime_sub(t1, t0)) *
+                                   BBQ10_EVENT_TS_LATCH_NUM / BBQ10_EVENT_TS_LATCH_DEN);
+            dev_now = bbq10_be32(&buf[1]);
+        }
+
+        for (i = 0; i < min_t(int, buf[0] & BBQ10_EVENT_HDR_COUNT_MASK, max); i++) {
+            u8 *rec = &buf[first + i * stride];
+
+            if (fw_timestamps)
+                time = bbq10_fw_time(ref, dev_now, bbq10_be32(&rec[BBQ10_EVENT_RECORD_SIZE]));
+
+            switch (rec[0]) {
+            case BBQ10_EVENT_TYPE_KEY:
+                bbq10_queue_key(data, rec[1], time);
+                keys = true;
+                break;
+            case BBQ10_EVENT_TYPE_MOTION:
+                bbq10_queue_trackball(data, &rec[1], time);
+                trackball = true;
+                break;
+            case BBQ10_EVENT_TYPE_BUTTON:
+                /* Button bitmap with the buttons format, else a click */
+                if (data->buttons) {
+                    bbq10_queue_buttons(data, rec[1], time);
+                } else {
+                    bbq10_queue_buttons(data, BBQ10_BUTTON_LEFT, time);
+                    bbq10_queue_buttons(data, 0, time);
+                }
+                trackball = true;
+                break;
+            default:
+                pr_err("bbq10_driver: unknown event type 0x%02x\n", rec[0]);
+                break;
+            }
+        }
+
+        if (buf[0] & BBQ10_EVENT_HDR_OVERFLOW)
+            overflow = true;
+
+        if (!(buf[0] & BBQ10_EVENT_HDR_MORE))
+            break;
+    }
+
+    /* The counter is only read when a burst flagged new drops */
+    if (overflow)
+        bbq10_check_key_overflow(data);
+
+    if (keys)
+        bbq10_dispatch(data, &data->key_work);
+
+    if (trackball)
+        bbq10_dispatch(data, &data->trackball_work);
+
+    /* Held while reporting so the two IRQ threads never consume the key fifo together */
+    mutex_unlock(&data->event_lock);
+}
+
+/* Drain every key the firmware has queued since the last interrupt */
+static void bbq10_fetch_keys(struct bbq10_data *data, ktime_t time)
+{
+    int count;
+    int ret;
+    int i;
+
+    if (event_fifo) {
+        bbq10_drain_events(data, time);
+        return;
+    }
+
+    count = bbq10_read_byte(data, ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_COUNT);
+    if (count < 0) {
+        pr_err("bbq10_driver: i2c_smbus_read_byte_data failed, ret=%d\n", count);
+        return;
+    }
+
+    for (i = 0; i < min(count, BBQ10_KEY_FIFO_SIZE); i++) {
+        ret = bbq10_read_byte(data, ECHODEV_REG_ADDR_READ_KEYBOARD);
+        if (ret < 0) {
+            pr_err("bbq10_driver: i2c_smbus_read_byte_data failed, ret=%d\n", ret);
+            break;
+        }
+
+        /* 0x00 means the firmware FIFO is empty */
+        if (ret == 0)
+            break;
+
+        bbq10_queue_key(data, (u8)ret, time);
+    }
+
+    bbq10_check_key_overflow(data);
+
+    /* Report the keys, or schedule work to do it */
+    bbq10_dispatch(data, &data->key_work);
+}
+
+static irqreturn_t bbq10_keyboard_irq_handler(int irq, void *dev_id)
+{
+    struct bbq10_data *data = dev_id;
+
+    data->stats.irqs++;
+    trace_bbq10_irq(irq, BBQ10_IRQ_SRC_KEYBOARD);
+
+    bbq10_fetch_keys(data, data->irq_time[0]);
 
     return IRQ_HANDLED;
 }
 
+/* Ease out: half of what is left goes out each frame, the last unit goes out whole */
+static s32 bbq10_smooth_step(s32 *left_q8)
+{
+    s32 step = *left_q8 / 2;
+
+    if (abs(*left_q8) <= BBQ10_MOTION_Q8)
+        step = *left_q8;
+
+    *left_q8 -= step;
+    return step;
+}
+
+/* Whole units of the accumulated motion, the fraction stays in the residue */
+static s32 bbq10_take_units(s32 *residue_q8, s32 step_q8)
+{
+    s32 units;
+
+    *residue_q8 += step_q8;
+    units = *residue_q8 / BBQ10_MOTION_Q8;
+    *residue_q8 -= units * BBQ10_MOTION_Q8;
+
+    return units;
+}
+
+static enum hrtimer_restart bbq10_smooth_timer_fn(struct hrtimer *timer)
+{
+    struct bbq10_data *data = container_of(timer, struct bbq10_data, smooth_timer);
+    struct input_dev *input = data->mouse_input;
+    unsigned long flags;
+    s32 dx, dy;
+    bool more;
+
+    spin_lock_irqsave(&data->motion_lock, flags);
+    dx = bbq10_take_units(&data->residue_dx_q8, bbq10_smooth_step(&data->smooth_dx_q8));
+    dy = bbq10_take_units(&data->residue_dy_q8, bbq10_smooth_step(&data->smooth_dy_q8));
+    more = data->smooth_dx_q8 || data->smooth_dy_q8;
+    /* Cleared under the lock, new motion after this starts the timer again */
+    if (!more)
+        data->smooth_armed = false;
+    spin_unlock_irqrestore(&data->motion_lock, flags);
+
+    if (dx || dy) {
+        input_report_rel(input, REL_X, dx);
+        input_report_rel(input, REL_Y, dy);
+        bbq10_sync(data, input, 0);
+    }
+
+    if (!more)
+        return HRTIMER_NORESTART;
+
+    hrtimer_forward_now(timer, data->smooth_period);
+    return HRTIMER_RESTART;
+}
+
+/* Report motion still being smoothed together with dx, dy in one frame, before a button change */
+static void bbq10_flush_motion(struct bbq10_data *data, s32 dx, s32 dy, ktime_t time)
+{
+    struct input_dev *input = data->mouse_input;
+    unsigned long flags;
+
+    spin_lock_irqsave(&data->motion_lock, flags);
+    dx += bbq10_take_units(&data->residue_dx_q8, data->smooth_dx_q8);
+    dy += bbq10_take_units(&data->residue_dy_q8, data->smooth_dy_q8);
+    data->smooth_dx_q8 = 0;
+    data->smooth_dy_q8 = 0;
+    spin_unlock_irqrestore(&data->motion_lock, flags);
+
+    /* An armed smoothing timer finds nothing left and stops */
+    if (!dx && !dy)
+        return;
+
+    input_report_rel(input, REL_X, dx);
+    input_report_rel(input, REL_Y, dy);
+    bbq10_sync_at(data, input, time);
+}
+
 /* Trackball work handler */
 static void bbq10_trackball_work_handler(struct work_struct *work)
 {
@@ -216,116 +794,424 @@ static void bbq10_trackball_work_handler(struct work_struct *work)
         container_of(work, struct bbq10_data, trackball_work);
 
     struct input_dev *input = data->mouse_input;
-    int i;
+    struct bbq10_button_event buttons[BBQ10_BUTTON_FIFO_SIZE];
+    unsigned long flags;
+    unsigned int nbuttons, i;
+    ktime_t time;
+    s32 dx, dy;
+    bool start;
+
+    spin_lock_irqsave(&data->motion_lock, flags);
+    time = data->motion_time;
+    dx = data->motion_dx;
+    dy = data->motion_dy;
+    nbuttons = kfifo_out(&data->button_fifo, buttons, BBQ10_BUTTON_FIFO_SIZE);
+    data->motion_dx = 0;
+    data->motion_dy = 0;
+    spin_unlock_irqrestore(&data->motion_lock, flags);
+
+    /*
+     * One frame per button change, after the motion that came before it, so a drag ends
+     * where the pointer was. A legacy click becomes a press and a release frame.
+     */
+    for (i = 0; i < nbuttons; i++) {
+        bbq10_flush_motion(data, buttons[i].dx, buttons[i].dy,
+                           (buttons[i].dx || buttons[i].dy) ? buttons[i].motion_time : buttons[i].time);
+        input_report_key(input, BTN_LEFT, !!(buttons[i].buttons & BBQ10_BUTTON_LEFT));
+        bbq10_sync_at(data, input, buttons[i].time);
+    }
 
-    bool is_tap =
-        data->trackball_value[0] == 0xFF &&
-        data->trackball_value[1] == 0xFF &&
-        data->trackball_value[2] == 0xFF &&
-        data->trackball_value[3] == 0xFF;
+    if (!dx && !dy)
+        return;
 
-    if (is_tap)
-    {
-        input_report_key(input, BTN_LEFT, 1);
-        input_sync(input);
+    dev_dbg(&data->client->dev, "mouse values (%d, %d)\n", dx, dy);
 
-        usleep_range(8000, 10000);
+    /* Pass-through: the whole delta in one frame */
+    if (!smooth_hz) {
+        input_report_rel(input, REL_X, dx);
+        input_report_rel(input, REL_Y, dy);
+        bbq10_sync_at(data, input, time);
+        return;
+    }
+
+    spin_lock_irqsave(&data->motion_lock, flags);
+    data->smooth_dx_q8 += dx * BBQ10_MOTION_Q8;
+    data->smooth_dy_q8 += dy * BBQ10_MOTION_Q8;
+    start = !data->smooth_armed;
+    data->smooth_armed = true;
+    spin_unlock_irqrestore(&data->motion_lock, flags);
+
+    /*
+     * An armed timer picks the new motion up on its next frame. hrtimer_is_queued() is
+     * false while the callback runs, starting it then would break its forward and restart.
+     */
+    if (start)
+        hrtimer_start(&data->smooth_timer, data->smooth_period, HRTIMER_MODE_REL);
+}
 
-        input_report_key(input, BTN_LEFT, 0);
-        input_sync(input);
+/* Versioned report: a button change or motion, never both */
+static void bbq10_fetch_trackball_report(struct bbq10_data *data, ktime_t time)
+{
+    u8 buf[BBQ10_TRACKBALL_REPORT_SIZE];
+    int ret;
 
+    ret = bbq10_read_block(data, ECHODEV_REG_ADDR_READ_TRACKBALL_REPORT,
+                           BBQ10_TRACKBALL_REPORT_SIZE, buf);
+    if (ret != BBQ10_TRACKBALL_REPORT_SIZE) {
+        pr_err("bbq10_driver: trackball report read failed, ret=%d\n", ret);
         return;
     }
 
-    s16 dx = (s16)((data->trackball_value[0] << 8) |
-                    data->trackball_value[1]);
-    s16 dy = (s16)((data->trackball_value[2] << 8) |
-                    data->trackball_value[3]);
+    if (buf[0] != BBQ10_TRACKBALL_REPORT_VERSION) {
+        pr_err("bbq10_driver: unknown trackball report version %u\n", buf[0]);
+        return;
+    }
 
-#ifdef BBQ10_DEBUG
-    pr_info("bbq10_driver: bbq10_trackball_work_handler mouse values (%d, %d)\n", dx, dy);
-#endif
+    if (buf[6] & BBQ10_FLAG_BUTTONS)
+        bbq10_queue_buttons(data, buf[5], time);
+    else
+        bbq10_queue_motion(data, (s16)((buf[1] << 8) | buf[2]), (s16)((buf[3] << 8) | buf[4]), time);
 
-    /* Split movement into small steps */
-    s16 abs_dx = dx < 0 ? -dx : dx;
-    s16 abs_dy = dy < 0 ? -dy : dy;
-    s16 steps = abs_dx > abs_dy ? abs_dx : abs_dy;
-    
-    if (steps == 0) return;
-    
-    /* Send movement in small increments */
-    for (i = 0; i < steps; i++) {
-        s16 step_x = 0, step_y = 0;
-        
-        if (abs_dx > 0) {
-            step_x = dx > 0 ? 1 : -1;
-            abs_dx--;
-        }
-        if (abs_dy > 0) {
-            step_y = dy > 0 ? 1 : -1;
-            abs_dy--;
-        }
-        
-        input_report_rel(input, REL_X, step_x);
-        input_report_rel(input, REL_Y, step_y);
-        input_sync(input);
-        
-        usleep_range(100, 500);  /* Very small delay between steps */
-    }
+    bbq10_dispatch(data, &data->trackball_work);
 }
 
-static irqreturn_t bbq10_trackball_irq_handler(int irq, void *dev_id)
+static void bbq10_fetch_trackball(struct bbq10_data *data, ktime_t time)
 {
-    struct bbq10_data *data = dev_id;
     int ret;
     u8 buf[4];
 
-    ret = i2c_smbus_read_i2c_block_data(data->client,
-                                        ECHODEV_REG_ADDR_READ_TRACKBALL,
-                                        4,
-                                        buf);
+    if (event_fifo) {
+        bbq10_drain_events(data, time);
+        return;
+    }
+
+    if (data->buttons) {
+        bbq10_fetch_trackball_report(data, time);
+        return;
+    }
+
+    ret = bbq10_read_block(data, ECHODEV_REG_ADDR_READ_TRACKBALL, 4, buf);
     if (ret < 0) {
         pr_err("bbq10_driver: i2c_smbus_read_i2c_block_data failed, ret=%d\n", ret);
-        return IRQ_HANDLED;
+        return;
     }
 
     if (ret != 4) {
         pr_err("bbq10_driver: expected 4 bytes, got %d\n", ret);
-        return IRQ_HANDLED;
+        return;
     }
 
-    /* Copy the 4 bytes into your driver data */
-    memcpy(data->trackball_value, buf, 4);
+    dev_dbg(&data->client->dev, "trackball values (%d, %d, %d, %d)\n",
+            buf[0], buf[1], buf[2], buf[3]);
+
+    /* Coalesce into the pending motion, a report the work has not handled yet is not lost */
+    bbq10_queue_trackball(data, buf, time);
+
+    /* Report the trackball data, or schedule work to do it */
+    bbq10_dispatch(data, &data->trackball_work);
+}
+
+static irqreturn_t bbq10_trackball_irq_handler(int irq, void *dev_id)
+{
+    struct bbq10_data *data = dev_id;
 
-#ifdef BBQ10_DEBUG
-    pr_info("bbq10_driver: bbq10_trackball_work_handler trackball values (%d, %d, %d, %d)\n", data->trackball_value[0],
-                                                                                             data->trackball_value[1],
-                                                                                             data->trackball_value[2],
-                                                                                             data->trackball_value[3]);
-#endif
+    data->stats.irqs++;
+    trace_bbq10_irq(irq, BBQ10_IRQ_SRC_TRACKBALL);
 
-    /* Schedule work to process the trackball data */
-    schedule_work(&data->trackball_work);
+    bbq10_fetch_trackball(data, data->irq_time[1]);
 
     return IRQ_HANDLED;
 }
 
+/* Primary handler: only record when the line was raised, the thread does the I2C work */
+static irqreturn_t bbq10_hard_irq_handler(int irq, void *dev_id)
+{
+    struct bbq10_data *data = dev_id;
+
+    data->irq_time[irq == data->irq[1]] = ktime_get();
+
+    return IRQ_WAKE_THREAD;
+}
+
+/* Level mode: the line stays high until INT_STATUS reads back zero */
+static irqreturn_t bbq10_level_irq_handler(int irq, void *dev_id)
+{
+    struct bbq10_data *data = dev_id;
+    ktime_t time = data->irq_time[0];
+    int status;
+    int i;
+
+    data->stats.irqs++;
+    trace_bbq10_irq(irq, BBQ10_IRQ_SRC_LEVEL);
+
+    for (i = 0; i < BBQ10_LEVEL_IRQ_MAX_LOOPS; i++) {
+        status = bbq10_read_byte(data, ECHODEV_REG_ADDR_READ_INT_STATUS);
+        if (status < 0) {
+            dev_err_ratelimited(&data->client->dev, "Failed to read INT_STATUS: %d\n", status);
+            /*
+             * The line is still high and the oneshot IRQ refires as soon as this returns.
+             * Mask it for a while rather than spin on a bus that keeps failing.
+             */
+            if (++data->irq_read_errors >= BBQ10_LEVEL_IRQ_MAX_ERRORS) {
+                data->irq_read_errors = 0;
+                disable_irq_nosync(irq);
+                schedule_delayed_work(&data->irq_retry_work,
+                                      msecs_to_jiffies(BBQ10_LEVEL_IRQ_RETRY_MS));
+            }
+            break;
+        }
+
+        data->irq_read_errors = 0;
+
+        if (!status)
+            break;
+
+        /* The line stayed high, anything found on a later pass arrived after the edge */
+        if (i)
+            time = ktime_get();
+
+        if (event_fifo) {
+            bbq10_drain_events(data, time);
+            continue;
+        }
+
+        if (status & BBQ10_INT_STATUS_KEY)
+            bbq10_fetch_keys(data, time);
+        if (status & BBQ10_INT_STATUS_TRACKBALL)
+            bbq10_fetch_trackball(data, time);
+    }
+
+    return IRQ_HANDLED;
+}
+
+static void bbq10_irq_retry_work_handler(struct work_struct *work)
+{
+    struct bbq10_data *data = container_of(work, struct bbq10_data, irq_retry_work.work);
+
+    enable_irq(data->irq[0]);
+}
+
+/* ASCII mode: enable every keycode bbq10_char_to_keycode() can produce */
+static void bbq10_setup_ascii_keys(struct input_dev *input)
+{
+    int i;
+
+    /* Enable all letter keys */
+    for (i = 0; i < 26; i++)
+        __set_bit(alphabet[i], input->keybit);
+
+    /* Enable number keys */
+    for (i = 0; i < 10; i++)
+        __set_bit(numbers[i], input->keybit);
+
+    /* Enable special keys */
+    __set_bit(KEY_SPACE, input->keybit);
+    __set_bit(KEY_ENTER, input->keybit);
+    __set_bit(KEY_BACKSPACE, input->keybit);
+    __set_bit(KEY_LEFTSHIFT, input->keybit);
+    __set_bit(KEY_DOT, input->keybit);
+    __set_bit(KEY_COMMA, input->keybit);
+    __set_bit(KEY_SLASH, input->keybit);
+    __set_bit(KEY_SEMICOLON, input->keybit);
+    __set_bit(KEY_APOSTROPHE, input->keybit);
+    __set_bit(KEY_MINUS, input->keybit);
+    __set_bit(KEY_EQUAL, input->keybit);
+}
+
+static int bbq10_latency_show(struct seq_file *s, void *unused)
+{
+    struct bbq10_data *data = s->private;
+    int i;
+
+    seq_printf(s, "%10s %10s\n", "<us", "count");
+    for (i = 0; i < BBQ10_LATENCY_BUCKETS - 1; i++)
+        seq_printf(s, "%10lu %10u\n", 1UL << i, data->stats.latency_hist[i]);
+    seq_printf(s, "%10s %10u\n", "more", data->stats.latency_hist[i]);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bbq10_latency);
+
+/* Indexed by the firmware's profile_probe_t */
+static const char * const bbq10_profile_names[] = {
+    "keyboard_scan", "scan_isr", "trackpad_exti", "report_isr", "i2c_ev_isr",
+};
+
+static int bbq10_fw_profile_show(struct seq_file *s, void *unused)
+{
+    struct bbq10_data *data = s->private;
+    u8 buf[BBQ10_PROFILE_REG_SIZE];
+    u32 hz, cycles_per_us;
+    int probes;
+    int ret;
+    int i;
+
+    ret = bbq10_read_block(data, ECHODEV_REG_ADDR_READ_PROFILE_INFO, BBQ10_PROFILE_INFO_SIZE, buf);
+    if (ret != BBQ10_PROFILE_INFO_SIZE)
+        return ret < 0 ? ret : -EIO;
+
+    hz = bbq10_be32(buf);
+    cycles_per_us = max_t(u32, hz / USEC_PER_SEC, 1);
+    probes = buf[4];
+
+    seq_printf(s, "core clock %u Hz, cycles:\n", hz);
+    seq_printf(s, "%-14s %10s %10s %10s %10s %10s\n", "probe", "count", "min", "max", "avg", "max_us");
+    for (i = 0; i < probes; i++) {
+        u32 max;
+
+        ret = bbq10_read_block(data, ECHODEV_REG_ADDR_READ_PROFILE + i, BBQ10_PROFILE_REG_SIZE, buf);
+        if (ret != BBQ10_PROFILE_REG_SIZE)
+            return ret < 0 ? ret : -EIO;
+
+        max = bbq10_be32(&buf[8]);
+        seq_printf(s, "%-14s %10u %10u %10u %10u %10u\n",
+                   i < ARRAY_SIZE(bbq10_profile_names) ? bbq10_profile_names[i] : "?",
+                   bbq10_be32(&buf[0]), bbq10_be32(&buf[4]), max, bbq10_be32(&buf[12]),
+                   max / cycles_per_us);
+    }
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bbq10_fw_profile);
+
+static void bbq10_debugfs_init(struct bbq10_data *data)
+{
+    struct bbq10_stats *st = &data->stats;
+    struct dentry *dir;
+
+    dir = debugfs_create_dir(dev_name(&data->client->dev), NULL);
+    data->debugfs = dir;
+
+    debugfs_create_u32("irqs", 0444, dir, &st->irqs);
+    debugfs_create_u32("key_events", 0444, dir, &st->key_events);
+    debugfs_create_u32("motion_reports", 0444, dir, &st->motion_reports);
+    debugfs_create_u32("clicks", 0444, dir, &st->clicks);
+    debugfs_create_u32("i2c_errors", 0444, dir, &st->i2c_errors);
+    debugfs_create_u32("key_drops", 0444, dir, &st->key_drops);
+    debugfs_create_u32("fw_key_drops", 0444, dir, &st->fw_key_drops);
+    debugfs_create_u32("motion_coalesced", 0444, dir, &st->motion_coalesced);
+    debugfs_create_file("latency_hist", 0444, dir, data, &bbq10_latency_fops);
+    debugfs_create_file("fw_profile", 0444, dir, data, &bbq10_fw_profile_fops);
+}
+
+static void bbq10_destroy_wq(void *wq)
+{
+    destroy_workqueue(wq);
+}
+
+/* Older firmware has no identification registers, it is then assumed to have no capabilities */
+static void bbq10_identify(struct bbq10_data *data)
+{
+    u8 buf[BBQ10_ID_SIZE];
+    int ret;
+
+    ret = bbq10_read_block(data, ECHODEV_REG_ADDR_DEVICE_ID, BBQ10_ID_SIZE, buf);
+    if (ret != BBQ10_ID_SIZE || buf[0] != BBQ10_DEVICE_ID) {
+        dev_info(&data->client->dev, "Firmware without identification registers\n");
+        return;
+    }
+
+    data->fw_version = (buf[1] << 8) | buf[2];
+    data->fw_caps = (buf[3] << 8) | buf[4];
+    dev_info(&data->client->dev, "Firmware %u.%u, capabilities 0x%04x\n",
+             buf[1], buf[2], data->fw_caps);
+}
+
+/*
+ * Let bare reads return the event burst, one address phase instead of two and no
+ * register byte per burst. Needs a plain I2C adapter and firmware with STREAM_CONFIG.
+ */
+static void bbq10_disable_stream(void *client)
+{
+    i2c_smbus_write_byte_data(client, ECHODEV_REG_ADDR_STREAM_CONFIG, 0);
+}
+
+static void bbq10_setup_stream(struct bbq10_data *data)
+{
+    u8 reg = fw_timestamps ? ECHODEV_REG_ADDR_READ_EVENTS_TS : ECHODEV_REG_ADDR_READ_EVENTS;
+    int ret;
+
+    if (!(data->fw_caps & BBQ10_CAP_STREAM))
+        return;
+
+    if (!event_fifo || !stream_read ||
+        !i2c_check_functionality(data->client->adapter, I2C_FUNC_I2C)) {
+        /* STREAM_CONFIG survives a driver reload, undo a previous stream_read=1 load */
+        ret = i2c_smbus_write_byte_data(data->client, ECHODEV_REG_ADDR_STREAM_CONFIG, 0);
+        if (ret < 0)
+            dev_warn(&data->client->dev, "Failed to disable stream reads: %d\n", ret);
+        return;
+    }
+
+    ret = i2c_smbus_write_byte_data(data->client, ECHODEV_REG_ADDR_STREAM_CONFIG, reg);
+    if (ret < 0) {
+        dev_warn(&data->client->dev, "Failed to enable stream reads: %d\n", ret);
+        return;
+    }
+
+    /* Turned off again on remove and when a later probe step fails */
+    if (devm_add_action_or_reset(&data->client->dev, bbq10_disable_stream, data->client))
+        return;
+
+    data->stream = true;
+}
+
+/* Ask for real press and release edges instead of synthetic clicks */
+static void bbq10_setup_buttons(struct bbq10_data *data)
+{
+    int ret;
+
+    if (!(data->fw_caps & BBQ10_CAP_BUTTONS))
+        return;
+
+    ret = i2c_smbus_write_byte_data(data->client, ECHODEV_REG_ADDR_TRACKBALL_FORMAT,
+                                    BBQ10_TRACKBALL_FORMAT_BUTTONS);
+    if (ret < 0) {
+        dev_warn(&data->client->dev, "Failed to select the button report format: %d\n", ret);
+        return;
+    }
+
+    data->buttons = true;
+}
+
 static int bbq10_probe(struct i2c_client *client,
                        const struct i2c_device_id *id)
 {
     struct bbq10_data *data;
     int ret;
-    int i;
 
     data = devm_kzalloc(&client->dev, sizeof(*data), GFP_KERNEL);
     if (!data)
         return -ENOMEM;
 
     data->client = client;
+    INIT_KFIFO(data->key_fifo);
+    INIT_KFIFO(data->button_fifo);
+    mutex_init(&data->event_lock);
+    spin_lock_init(&data->motion_lock);
+
+    bbq10_identify(data);
+    bbq10_setup_stream(data);
+    bbq10_setup_buttons(data);
+
+    hrtimer_init(&data->smooth_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    data->smooth_timer.function = bbq10_smooth_timer_fn;
+    data->smooth_period = ns_to_ktime(NSEC_PER_SEC / clamp(smooth_hz, 1U, (unsigned int)BBQ10_SMOOTH_MAX_HZ));
 
     /* Initialize work queues */
     INIT_WORK(&data->key_work, bbq10_key_work_handler);
     INIT_WORK(&data->trackball_work, bbq10_trackball_work_handler);
+    INIT_DELAYED_WORK(&data->irq_retry_work, bbq10_irq_retry_work_handler);
+
+    if (report_policy == BBQ10_REPORT_HIGHPRI_WQ) {
+        data->wq = alloc_ordered_workqueue("bbq10", WQ_HIGHPRI);
+        if (!data->wq)
+            return -ENOMEM;
+
+        ret = devm_add_action_or_reset(&client->dev, bbq10_destroy_wq, data->wq);
+        if (ret)
+            return ret;
+    }
 
     /* Create native keyboard input device */
     data->kbd_input = devm_input_allocate_device(&client->dev);
@@ -346,26 +1232,32 @@ static int bbq10_probe(struct i2c_client *client,
     __set_bit(EV_KEY, data->kbd_input->evbit);
     __set_bit(EV_REP, data->kbd_input->evbit);  /* Enable key repeat */
 
-    /* Enable all letter keys */
-    for (i = 0; i < 26; i++)
-        __set_bit(alphabet[i], data->kbd_input->keybit);
+    /* A linux,keymap property selects raw scancode mode, keycodes are remappable via EVIOCSKEYCODE */
+    data->raw_mode = device_property_present(&client->dev, "linux,keymap");
+    if (data->raw_mode) {
+        ret = matrix_keypad_build_keymap(NULL, NULL, BBQ10_MATRIX_ROWS, BBQ10_MATRIX_COLS,
+                                         NULL, data->kbd_input);
+        if (ret) {
+            dev_err(&client->dev, "Failed to build keymap: %d\n", ret);
+            return ret;
+        }
 
-    /* Enable number keys */
-    for (i = 0; i < 10; i++)
-        __set_bit(numbers[i], data->kbd_input->keybit);
+        input_set_capability(data->kbd_input, EV_MSC, MSC_SCAN);
 
-    /* Enable special keys */
-    __set_bit(KEY_SPACE, data->kbd_input->keybit);
-    __set_bit(KEY_ENTER, data->kbd_input->keybit);
-    __set_bit(KEY_BACKSPACE, data->kbd_input->keybit);
-    __set_bit(KEY_LEFTSHIFT, data->kbd_input->keybit);
-    __set_bit(KEY_DOT, data->kbd_input->keybit);
-    __set_bit(KEY_COMMA, data->kbd_input->keybit);
-    __set_bit(KEY_SLASH, data->kbd_input->keybit);
-    __set_bit(KEY_SEMICOLON, data->kbd_input->keybit);
-    __set_bit(KEY_APOSTROPHE, data->kbd_input->keybit);
-    __set_bit(KEY_MINUS, data->kbd_input->keybit);
-    __set_bit(KEY_EQUAL, data->kbd_input->keybit);
+        ret = i2c_smbus_write_byte_data(client, ECHODEV_REG_ADDR_KEYBOARD_MODE,
+                                        BBQ10_KEYBOARD_MODE_RAW);
+        if (ret < 0) {
+            dev_err(&client->dev, "Failed to select raw keyboard mode: %d\n", ret);
+            return ret;
+        }
+    } else {
+        bbq10_setup_ascii_keys(data->kbd_input);
+
+        ret = i2c_smbus_write_byte_data(client, ECHODEV_REG_ADDR_KEYBOARD_MODE,
+                                        BBQ10_KEYBOARD_MODE_ASCII);
+        if (ret < 0)
+            dev_warn(&client->dev, "Failed to select ASCII keyboard mode: %d\n", ret);
+    }
 
     /* Register keyboard input device */
     ret = input_register_device(data->kbd_input);
@@ -416,8 +1308,35 @@ static int bbq10_probe(struct i2c_client *client,
         return data->irq[0];
     }
 
+    if (level_irq) {
+        /* One level interrupt for both devices, the trackball gpio is not needed */
+        ret = i2c_smbus_write_byte_data(client, ECHODEV_REG_ADDR_INT_CONFIG,
+                                        BBQ10_INT_CONFIG_LEVEL);
+        if (ret < 0) {
+            dev_err(&client->dev, "Failed to select level interrupt mode: %d\n", ret);
+            return ret;
+        }
+
+        ret = devm_request_threaded_irq(&client->dev, data->irq[0],
+                                        bbq10_hard_irq_handler, bbq10_level_irq_handler,
+                                        IRQF_TRIGGER_HIGH | IRQF_ONESHOT,
+                                        "bbq10", data);
+        if (ret) {
+            dev_err(&client->dev, "Failed to request IRQ: %d\n", ret);
+            return ret;
+        }
+
+        goto out;
+    }
+
+    /* INT_CONFIG survives a driver reload, undo a previous level_irq=1 load */
+    ret = i2c_smbus_write_byte_data(client, ECHODEV_REG_ADDR_INT_CONFIG,
+                                    BBQ10_INT_CONFIG_PULSE);
+    if (ret < 0)
+        dev_warn(&client->dev, "Failed to select pulsed interrupt mode: %d\n", ret);
+
     ret = devm_request_threaded_irq(&client->dev, data->irq[0],
-                                    NULL, bbq10_keyboard_irq_handler,
+                                    bbq10_hard_irq_handler, bbq10_keyboard_irq_handler,
                                     IRQF_TRIGGER_RISING | IRQF_ONESHOT,
                                     "bbq10", data);
     if (ret) {
@@ -439,7 +1358,7 @@ static int bbq10_probe(struct i2c_client *client,
     }
 
     ret = devm_request_threaded_irq(&client->dev, data->irq[1],
-                                    NULL, bbq10_trackball_irq_handler,
+                                    bbq10_hard_irq_handler, bbq10_trackball_irq_handler,
                                     IRQF_TRIGGER_RISING | IRQF_ONESHOT,
                                     "bbq10", data);
     if (ret) {
@@ -447,7 +1366,9 @@ static int bbq10_probe(struct i2c_client *client,
         return ret;
     }
 
+out:
     i2c_set_clientdata(client, data);
+    bbq10_debugfs_init(data);
     dev_info(&client->dev, "bbq10 keyboard and trackball driver probed successfully\n");
 
     return 0;
@@ -457,8 +1378,16 @@ static void bbq10_remove(struct i2c_client *client)
 {
     struct bbq10_data *data = i2c_get_clientdata(client);
     
+    /* The devm IRQs outlive remove(), stop their threads before they queue work or arm the timer */
+    disable_irq(data->irq[0]);
+    if (!level_irq)
+        disable_irq(data->irq[1]);
+
+    cancel_delayed_work_sync(&data->irq_retry_work);
     cancel_work_sync(&data->key_work);
     cancel_work_sync(&data->trackball_work);
+    hrtimer_cancel(&data->smooth_timer);
+    debugfs_remove_recursive(data->debugfs);
     
     dev_info(&client->dev, "bbq10 driver removed\n");
 }
@@ -0,0 +1,112 @@
+/**
+ * Tracepoints for the Blackberry Q10 keyboard + 303TRACKBA1 trackball Linux driver
+ *
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Enable with e.g. "echo 1 > /sys/kernel/tracing/events/bbq10/enable".
+ * The driver's Kbuild needs "CFLAGS_bbq10_driver.o := -I$(src)" so that
+ * define_trace.h finds this header.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM bbq10
+
+#if !defined(_BBQ10_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BBQ10_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* Interrupt sources */
+#define BBQ10_IRQ_SRC_KEYBOARD 0
+#define BBQ10_IRQ_SRC_TRACKBALL 1
+#define BBQ10_IRQ_SRC_LEVEL 2
+
+/* Input devices */
+#define BBQ10_INPUT_KEYBOARD 0
+#define BBQ10_INPUT_TRACKBALL 1
+
+TRACE_EVENT(bbq10_irq,
+    TP_PROTO(int irq, int source),
+    TP_ARGS(irq, source),
+
+    TP_STRUCT__entry(
+        __field(int, irq)
+        __field(int, source)
+    ),
+
+    TP_fast_assign(
+        __entry->irq = irq;
+        __entry->source = source;
+    ),
+
+    TP_printk("irq=%d source=%s", __entry->irq,
+              __print_symbolic(__entry->source,
+                               { BBQ10_IRQ_SRC_KEYBOARD, "keyboard" },
+                               { BBQ10_IRQ_SRC_TRACKBALL, "trackball" },
+                               { BBQ10_IRQ_SRC_LEVEL, "level" }))
+);
+
+TRACE_EVENT(bbq10_i2c_read,
+    TP_PROTO(u8 reg, int len, int ret),
+    TP_ARGS(reg, len, ret),
+
+    TP_STRUCT__entry(
+        __field(u8, reg)
+        __field(int, len)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->reg = reg;
+        __entry->len = len;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("reg=0x%02x len=%d ret=%d", __entry->reg, __entry->len, __entry->ret)
+);
+
+TRACE_EVENT(bbq10_input_sync,
+    TP_PROTO(int input, s64 latency_ns),
+    TP_ARGS(input, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(int, input)
+        __field(s64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->input = input;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("input=%s latency_ns=%lld",
+              __print_symbolic(__entry->input,
+                               { BBQ10_INPUT_KEYBOARD, "keyboard" },
+                               { BBQ10_INPUT_TRACKBALL, "trackball" }),
+              __entry->latency_ns)
+);
+
+#endif /* _BBQ10_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE bbq10_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,52 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_ACCEL_H_
+#define INC_ACCEL_H_
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Fixed-point pointer acceleration driven by measured pulse velocity.
+ * Gains are Q8.8 (256 = 1.0) and velocity is in pulses per second, taken from the
+ * time between consecutive samples of an axis. The fractional part of every scaled
+ * movement is carried to the next sample so slow motion is not rounded away.
+ */
+#define ACCEL_GAIN_ONE 256
+
+typedef enum {
+    ACCEL_CURVE_NONE,
+    ACCEL_CURVE_LINEAR,
+    ACCEL_CURVE_POWER,
+    ACCEL_CURVE_LUT
+} accel_curve_t;
+
+typedef struct {
+    uint32_t last_us;
+    int32_t residue_q8;
+} accel_axis_t;
+
+/* Functions */
+void accel_configure(accel_curve_t curve);
+accel_curve_t accel_get_curve(void);
+uint16_t accel_gain_q8(uint32_t pulses_per_s);
+int32_t accel_apply(accel_axis_t *axis, int32_t pulses, int32_t step, uint32_t now_us);
+
+#endif /* INC_ACCEL_H_ */
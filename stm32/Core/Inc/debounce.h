@@ -0,0 +1,38 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_DEBOUNCE_H_
+#define INC_DEBOUNCE_H_
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Per-key debounce for a packed 64-bit key matrix, run once per full matrix scan.
+ * Deferred mode: a key changes state once its raw value has differed for the threshold.
+ * Eager-press mode: a press is reported on the first sample and the key is then locked
+ * for the press threshold, releases are still deferred.
+ * Work per scan is proportional to the number of keys that are bouncing.
+ */
+
+/* Functions */
+void debounce_configure(uint16_t press_ms, uint16_t release_ms, uint8_t eager_press, uint16_t scan_rate_hz);
+uint64_t debounce_update(uint64_t raw);
+
+#endif /* INC_DEBOUNCE_H_ */
@@ -0,0 +1,49 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_HOST_IRQ_H_
+#define INC_HOST_IRQ_H_
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Host interrupt signalling. Pulse mode drives the separate KEYBOARD_IRQ (PB13) and
+ * TRACKPAD_IRQ (PB12) lines with short edges. Level mode holds KEYBOARD_IRQ high for as
+ * long as any event is pending and leaves TRACKPAD_IRQ unused, the host reads
+ * INT_STATUS to find out what to drain.
+ */
+#define HOST_IRQ_MODE_PULSE  0
+#define HOST_IRQ_MODE_LEVEL  1
+
+#ifndef HOST_IRQ_DEFAULT_MODE
+#define HOST_IRQ_DEFAULT_MODE HOST_IRQ_MODE_PULSE
+#endif
+
+/* INT_STATUS bits */
+#define HOST_IRQ_STATUS_KEY        0x01  // Key FIFO is not empty
+#define HOST_IRQ_STATUS_TRACKBALL  0x02  // A trackball report is waiting to be read
+
+/* Functions */
+uint8_t host_irq_get_mode(void);
+void host_irq_set_mode(uint8_t mode);
+uint8_t host_irq_status(void);
+void host_irq_update(void);
+
+#endif /* INC_HOST_IRQ_H_ */
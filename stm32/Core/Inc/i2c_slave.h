@@ -25,22 +25,106 @@
 
 #define KEYBOARD_I2C_ADDRESS (0x52)
 
+#define ECHODEV_REG_ADDR_DEVICE_ID      0x00 // REGFILE_DEVICE_ID
+#define ECHODEV_REG_ADDR_FW_VERSION     0x01 // 2 bytes: major, minor
+#define ECHODEV_REG_ADDR_CAPABILITIES   0x02 // 2 bytes of REGFILE_CAP_* bits
 #define ECHODEV_REG_ADDR_READ_KEYBOARD  0x10
+#define ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_COUNT    0x11
+#define ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_OVERFLOW 0x12
+#define ECHODEV_REG_ADDR_KEYBOARD_MODE               0x13
 #define ECHODEV_REG_ADDR_READ_TRACKBALL 0x20
+#define ECHODEV_REG_ADDR_READ_TRACKBALL_REPORT 0x21 // versioned report, see TRACKBALL_REPORT_SIZE
+#define ECHODEV_REG_ADDR_TRACKBALL_FORMAT      0x22 // TRACKPAD_FORMAT_CLICK or TRACKPAD_FORMAT_BUTTONS
+#define ECHODEV_REG_ADDR_READ_EVENTS    0x30
+#define ECHODEV_REG_ADDR_READ_EVENTS_TS 0x31
+#define ECHODEV_REG_ADDR_STREAM_CONFIG  0x32 // register returned by reads without a register write, 0 = off
+#define ECHODEV_REG_ADDR_READ_INT_STATUS 0x40
+#define ECHODEV_REG_ADDR_INT_CONFIG      0x41
+#define ECHODEV_REG_ADDR_READ_DEVICE_TIME 0x50 // 4-byte timebase_us(), big-endian, latched at the read
+#define ECHODEV_REG_ADDR_READ_PROFILE   0x60 // 0x60 + profile_probe_t, see PROFILE_REG_SIZE
+#define ECHODEV_REG_ADDR_READ_PROFILE_INFO 0x6F // 4-byte core clock in Hz, 1-byte probe count
 
-extern I2C_HandleTypeDef hi2c1;
+/* Runtime configuration, read/write, see keyboard_config_t and trackpad.h for the ranges */
+#define ECHODEV_REG_ADDR_KEYBOARD_SCAN_RATE        0x80 // 2 bytes, full matrix scans per second
+#define ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_PRESS   0x81 // ms
+#define ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_RELEASE 0x82 // ms
+#define ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_EAGER   0x83 // 0 or 1
+#define ECHODEV_REG_ADDR_KEYBOARD_HOLD_DELAY       0x84 // 2 bytes, ms
+#define ECHODEV_REG_ADDR_KEYBOARD_REPEAT_INTERVAL  0x85 // 2 bytes, ms
+#define ECHODEV_REG_ADDR_TRACKPAD_REPORT_RATE      0x86 // 2 bytes, 125, 250, 500 or 1000 Hz
+#define ECHODEV_REG_ADDR_TRACKPAD_ACCEL_CURVE      0x87 // accel_curve_t
+#define ECHODEV_REG_ADDR_TRACKPAD_LED              0x88 // color_t
+
+/*
+ * Trackball report returned by ECHODEV_REG_ADDR_READ_TRACKBALL_REPORT: version, dx and dy
+ * (big-endian), the TRACKPAD_BUTTON_* bitmap and TRACKPAD_FLAG_* bits. The 4-byte 0x20
+ * register is the same report with a button press replaced by the 0xFFFF/0xFFFF marker.
+ */
+#define TRACKBALL_REPORT_VERSION 1
+#define TRACKBALL_REPORT_SIZE    7
+
+// Profile probe register: count, min, max and average cycles, 4 bytes each, big-endian
+#define PROFILE_REG_SIZE 16
 
-extern uint8_t I2C_RxData[1];
+/*
+ * Event burst returned by ECHODEV_REG_ADDR_READ_EVENTS: one header byte followed by
+ * EVENT_BURST_MAX records of EVENT_RECORD_SIZE bytes, unused records are all zero.
+ * Header bits 5..0 = records in this burst, bit 6 = the key FIFO dropped keys since the
+ * previous burst (read 0x12 for the count), bit 7 = more events are still queued.
+ */
+#define EVENT_BURST_MAX       6
+#define EVENT_RECORD_SIZE     5
+#define EVENT_BURST_SIZE      (1 + EVENT_BURST_MAX * EVENT_RECORD_SIZE) // 31, fits an SMBus block
+#define EVENT_HDR_MORE        0x80
+#define EVENT_HDR_OVERFLOW    0x40
+#define EVENT_HDR_COUNT_MASK  0x3F
+
+/* Record layout: type byte followed by 4 payload bytes */
+#define EVENT_TYPE_NONE    0x00
+#define EVENT_TYPE_KEY     0x01 // payload[0] = key byte as read from 0x10 (character or raw code)
+#define EVENT_TYPE_MOTION  0x02 // payload = dx high, dx low, dy high, dy low
+#define EVENT_TYPE_BUTTON  0x03 // payload[0] = TRACKPAD_BUTTON_* bitmap, payload[1] = TRACKPAD_FLAG_* bits
+
+/*
+ * Timestamped burst returned by ECHODEV_REG_ADDR_READ_EVENTS_TS: the header byte, the device
+ * time latched when the read started, then EVENT_TS_BURST_MAX records, each one the record
+ * above followed by the time the event happened. Times are timebase_us() values, big-endian.
+ */
+#define EVENT_TS_BURST_MAX    3
+#define EVENT_TS_RECORD_SIZE  (EVENT_RECORD_SIZE + 4)
+#define EVENT_TS_BURST_SIZE   (5 + EVENT_TS_BURST_MAX * EVENT_TS_RECORD_SIZE) // 32, the SMBus block limit
+
+/*
+ * Bus speed the slave is set up for. The F411 I2C peripheral supports Standard and
+ * Fast mode only, so 400 kHz is the ceiling (Fast-mode Plus needs the FMPI2C block
+ * of the F410/F413/F446). Fast mode needs PCLK1 of at least 4 MHz.
+ */
+#ifndef I2C_SLAVE_BUS_HZ
+#define I2C_SLAVE_BUS_HZ 400000
+#endif
+
+#if I2C_SLAVE_BUS_HZ > 400000
+#error "I2C1 on the STM32F411 does not support Fast-mode Plus"
+#endif
+
+/*
+ * Stream register replies of at least I2C_SLAVE_DMA_MIN_BYTES are sent by DMA1 Stream6
+ * (I2C1_TX, channel 1), one DMA completion instead of one interrupt per byte. Shorter ones
+ * and auto-increment reads, which the host usually ends early, stay interrupt driven.
+ */
+#ifndef I2C_SLAVE_TX_DMA
+#define I2C_SLAVE_TX_DMA 1
+#endif
+#define I2C_SLAVE_DMA_MIN_BYTES 4
+
+extern I2C_HandleTypeDef hi2c1;
 
-// volatile because accessed from ISR
-extern volatile uint8_t I2C_Keyboard_TxData[1];
-extern volatile uint8_t i2c_busy;
+extern uint8_t I2C_RxData[2];
 
 void MX_I2C1_Init_Slave(void);
 void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c);
-void wait_i2c_busy(void);
-void set_i2c_keyboard_txdata(char c);
-void set_i2c_trackpad_txdata(int16_t dx, int16_t dy);
-void set_i2c_trackpad_mouseclick_txdata(void);
+void set_i2c_trackpad_txdata(int16_t dx, int16_t dy, uint8_t buttons, uint8_t flags);
+void get_i2c_trackpad_txdata(uint8_t *buf);
+void get_i2c_trackpad_report(uint8_t *buf);
 
 #endif /* INC_I2C_SLAVE_H_ */
@@ -0,0 +1,41 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_KEY_FIFO_H_
+#define INC_KEY_FIFO_H_
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Single-producer/single-consumer ring buffer of key events.
+ * The producer is the main loop (keyboard processing), the consumer is the I2C ISR.
+ * Each index is only ever written by one side, so no locking is needed.
+ * Every key carries the timebase_us() time at which it was detected.
+ */
+#define KEY_FIFO_SIZE 64 // Must be a power of two, at most 128
+
+/* Functions */
+uint8_t key_fifo_push(uint8_t key, uint32_t time_us);
+uint8_t key_fifo_pop(uint8_t *key, uint32_t *time_us);
+uint8_t key_fifo_count(void);
+uint8_t key_fifo_overflow_count(void);
+void key_fifo_flush(void);
+
+#endif /* INC_KEY_FIFO_H_ */
@@ -23,15 +23,66 @@
 
 #include "stm32f4xx_hal.h"
 
+/* Scan engine configuration, defaults for keyboard_config_t where it has a field */
+#define KEYBOARD_SCAN_RATE_HZ           1000  // Full matrix scans per second (1-2 kHz)
+#define KEYBOARD_SCAN_SETTLE_US         10    // Time a column is driven low before rows are sampled
+#define KEYBOARD_DEBOUNCE_PRESS_MS      5     // A press must be stable this long (or lockout time in eager mode)
+#define KEYBOARD_DEBOUNCE_RELEASE_MS    5     // A release must be stable this long
+#define KEYBOARD_DEBOUNCE_EAGER_PRESS   0     // 1 = report presses on the first sample, defer releases only
+#define KEYBOARD_HOLD_DELAY_MS          750   // Press-and-hold time before a key starts repeating
+#define KEYBOARD_REPEAT_INTERVAL_MS     16    // Repeat interval while a key is held
+#define KEYBOARD_IRQ_PULSE_US           200   // Minimum KEYBOARD_IRQ pulse width, timed by the scan timer
+#define KEYBOARD_IRQ_RETRIGGER_MS       20    // Re-pulse the IRQ line while the key FIFO is not drained
+
+/* Limits for runtime changes through keyboard_set_config() */
+#define KEYBOARD_SCAN_RATE_MIN_HZ       100
+#define KEYBOARD_SCAN_RATE_MAX_HZ       2000
+#define KEYBOARD_HOLD_DELAY_MAX_MS      5000
+
+/* 1 = report every simultaneously held key and allow modifier chords, phantom keys are suppressed either way */
+#ifndef KEYBOARD_NKRO
+#define KEYBOARD_NKRO                   1
+#endif
+
+/* Set to 1 to scan through HAL_GPIO_ReadPin/WritePin instead of direct IDR/BSRR access */
+#ifndef KEYBOARD_SCAN_USE_HAL
+#define KEYBOARD_SCAN_USE_HAL           0
+#endif
+
+/* Report modes, selected by the host through the KEYBOARD_MODE register */
+#define KEYBOARD_MODE_ASCII  0  // Firmware resolves modifiers and queues one character per key
+#define KEYBOARD_MODE_RAW    1  // Firmware queues a press/release event per matrix key
+
+/* Raw event encoding: bit 7 = pressed, bits 6..0 = row * NUM_COLS + col + 1 (never 0x00) */
+#define KEYBOARD_RAW_PRESSED       0x80
+#define KEYBOARD_RAW_CODE_MASK     0x7F
+
+/* Runtime tunables, invalid combinations are ignored by keyboard_set_config() */
+typedef struct
+{
+    uint16_t scan_rate_hz;
+    uint8_t  debounce_press_ms;
+    uint8_t  debounce_release_ms;
+    uint8_t  debounce_eager_press;
+    uint16_t hold_delay_ms;
+    uint16_t repeat_interval_ms;  // at most hold_delay_ms
+} keyboard_config_t;
+
 /* Keyboard States */
 // Following is volatile mostly because of live debugging purposes
 extern volatile char last_pressed_key;
 
 /* Functions */
 void keyboard_init(void);
+void keyboard_scan_timer_init(void);
 void keyboard_scan(void);
 char keyboard_find_key(void);
 uint8_t keyboard_is_key_changed();
+uint8_t keyboard_get_mode(void);
+void keyboard_set_mode(uint8_t mode);
+uint32_t keyboard_get_scan_time(void);
+void keyboard_get_config(keyboard_config_t *cfg);
+void keyboard_set_config(const keyboard_config_t *cfg);
 void keyboard_generate_irq_pulse(void);
 
 #endif /* INC_KEYBOARD_H_ */
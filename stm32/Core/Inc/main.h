@@ -41,6 +41,13 @@ extern "C" {
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
+/* System clock profiles, selected with SYSCLK_PROFILE */
+#define SYSCLK_PROFILE_HSI_16MHZ   0 /* HSI directly, no wait states */
+#define SYSCLK_PROFILE_PLL_100MHZ  1 /* HSI through the PLL, APB1 at 50 MHz, APB2 at 100 MHz */
+
+#ifndef SYSCLK_PROFILE
+#define SYSCLK_PROFILE SYSCLK_PROFILE_PLL_100MHZ
+#endif
 
 /* USER CODE END EC */
 
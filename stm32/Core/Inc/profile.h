@@ -0,0 +1,83 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_PROFILE_H_
+#define INC_PROFILE_H_
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Cycle-accurate profiling on the DWT cycle counter. PROFILE_SCOPE() at the top of a
+ * function or block records the cycles spent until it goes out of scope. Each probe
+ * keeps count, min, max and total cycles, readable over I2C (see i2c_slave.h).
+ * Build with PROFILE_ENABLE=0 to compile the probes out.
+ */
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 1
+#endif
+
+typedef enum
+{
+    PROFILE_KEYBOARD_SCAN = 0, // keyboard_scan() in the main loop
+    PROFILE_SCAN_ISR,          // TIM3 matrix scan interrupt
+    PROFILE_TRACKPAD_EXTI,     // trackball pin EXTI interrupts
+    PROFILE_REPORT_ISR,        // TIM4 report scheduler interrupt
+    PROFILE_I2C_EV_ISR,        // I2C1 event interrupt
+    PROFILE_PROBE_COUNT
+} profile_probe_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} profile_stats_t;
+
+typedef struct
+{
+    profile_probe_t probe;
+    uint32_t start;
+} profile_scope_t;
+
+/* Functions */
+void profile_init(void);
+void profile_record(profile_probe_t probe, uint32_t cycles);
+void profile_get(profile_probe_t probe, profile_stats_t *stats);
+void profile_reset(void);
+
+static inline uint32_t profile_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+static inline void profile_scope_end(profile_scope_t *scope)
+{
+    profile_record(scope->probe, profile_cycles() - scope->start);
+}
+
+#if PROFILE_ENABLE
+#define PROFILE_SCOPE(probe) \
+    profile_scope_t profile_scope __attribute__((cleanup(profile_scope_end))) = { (probe), profile_cycles() }
+#else
+#define PROFILE_SCOPE(probe) do { } while (0)
+#endif
+
+#endif /* INC_PROFILE_H_ */
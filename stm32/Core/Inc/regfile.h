@@ -0,0 +1,63 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_REGFILE_H_
+#define INC_REGFILE_H_
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Register file behind the I2C slave, addresses are in i2c_slave.h. Every register has a
+ * fixed size and is big-endian. A read of a plain register runs on into the registers at
+ * the following addresses for as long as the host keeps clocking, each one fetched when
+ * the previous one has gone out, and continues with zeros past the last plain register.
+ * Stream registers (key FIFO, trackball report, event bursts) have side effects and are
+ * always returned on their own. Writes advance the same way, a register is applied once
+ * all its bytes have arrived. With STREAM_CONFIG set, a read that was not preceded by a
+ * register write in the same transaction returns that stream register, so the host can
+ * fetch events with a bare read.
+ */
+#define REGFILE_WINDOW  32  // longest single register, the SMBus block limit
+
+/* Identification registers */
+#define REGFILE_DEVICE_ID        0xB1
+#define FIRMWARE_VERSION_MAJOR   1
+#define FIRMWARE_VERSION_MINOR   1
+
+/* CAPABILITIES bits */
+#define REGFILE_CAP_EVENTS       0x0001  // EVENTS burst register
+#define REGFILE_CAP_EVENTS_TS    0x0002  // EVENTS_TS burst with firmware timestamps
+#define REGFILE_CAP_LEVEL_IRQ    0x0004  // INT_STATUS and INT_CONFIG level mode
+#define REGFILE_CAP_RAW_KEYS     0x0008  // KEYBOARD_MODE raw matrix events
+#define REGFILE_CAP_PROFILE      0x0010  // PROFILE registers are populated
+#define REGFILE_CAP_TX_DMA       0x0020  // stream registers are sent by DMA
+#define REGFILE_CAP_CONFIG       0x0040  // runtime configuration registers
+#define REGFILE_CAP_STREAM       0x0080  // STREAM_CONFIG, reads without a register write
+#define REGFILE_CAP_BUTTONS      0x0100  // TRACKBALL_REPORT and TRACKBALL_FORMAT, button press and release
+
+/* Functions */
+uint8_t regfile_read(uint8_t reg, uint8_t *buf);
+uint8_t regfile_is_stream(uint8_t reg);
+uint8_t regfile_is_plain(uint8_t reg);
+uint8_t regfile_get_stream_reg(void);
+void regfile_write_start(uint8_t reg);
+void regfile_write_byte(uint8_t byte);
+
+#endif /* INC_REGFILE_H_ */
@@ -0,0 +1,38 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_TIMEBASE_H_
+#define INC_TIMEBASE_H_
+
+#include "stm32f4xx_hal.h"
+
+/* Free-running 32-bit microsecond counter on TIM5, wraps every ~71 minutes */
+#define TIMEBASE_TIMER  TIM5
+
+/* Functions */
+void timebase_init(void);
+uint32_t timebase_apb1_timer_clock(void);
+
+static inline uint32_t timebase_us(void)
+{
+    return TIMEBASE_TIMER->CNT;
+}
+
+#endif /* INC_TIMEBASE_H_ */
@@ -25,6 +25,35 @@
 
 #define TRACKPAD_BTN_DEBOUNCE_MS 20
 
+/* Button report format, selected by the host through TRACKBALL_FORMAT */
+#define TRACKPAD_FORMAT_CLICK    0  // press edges only, the 0xFFFF/0xFFFF marker on TRACKBALL_VALUE
+#define TRACKPAD_FORMAT_BUTTONS  1  // button state on press and release edges
+
+/* Button bitmap and flags of a report */
+#define TRACKPAD_BUTTON_LEFT     0x01  // trackball press
+#define TRACKPAD_FLAG_BUTTONS    0x01  // the buttons changed, the report carries no motion
+#define TRACKPAD_FLAG_CLAMPED    0x02  // dx or dy saturated, some motion was lost
+
+/* Report scheduler, TIM4 publishes coalesced deltas at this rate (125, 250, 500 or 1000 Hz) */
+#define TRACKPAD_REPORT_RATE_HZ      250
+#define TRACKPAD_IRQ_PULSE_US        100  // TRACKPAD_IRQ pulse width, ended by the report timer
+#define TRACKPAD_IRQ_RETRIGGER_MS    20   // Re-pulse the IRQ line while a report is not fetched
+
+/* Acceleration curve, one of ACCEL_CURVE_NONE/LINEAR/POWER/LUT from accel.h */
+#define TRACKPAD_ACCEL_CURVE ACCEL_CURVE_LUT
+
+/*
+ * Pulse capture modes. In timer mode LFT (PA15, TIM2_ETR) and RHT (PA9, TIM1_CH2) clock
+ * hardware counters that are sampled at the report rate, costing no CPU per pulse.
+ * UP (PB14) and DWN (PA11) have no usable timer clock input on the F411 and stay on EXTI.
+ */
+#define TRACKPAD_CAPTURE_EXTI  0
+#define TRACKPAD_CAPTURE_TIMER 1
+
+#ifndef TRACKPAD_CAPTURE_MODE
+#define TRACKPAD_CAPTURE_MODE TRACKPAD_CAPTURE_EXTI
+#endif
+
 typedef enum {
 	RED,
 	GREEN,
@@ -39,6 +68,15 @@ void trackpad_init(void);
 void trackpad_exti_callback(uint16_t GPIO_Pin);
 void trackpad_get_deltas(int16_t *dx, int16_t *dy, uint8_t *btn);
 void trackpad_generate_irq_pulse(void);
+void trackpad_report_timer_init(void);
+void trackpad_set_report_rate(uint16_t rate_hz);
+uint16_t trackpad_get_report_rate(void);
+void trackpad_report_consumed(void);
+uint8_t trackpad_report_is_pending(void);
+uint8_t trackpad_take_report(int16_t *dx, int16_t *dy, uint8_t *buttons, uint8_t *flags, uint32_t *time_us);
+void trackpad_set_format(uint8_t format);
+uint8_t trackpad_get_format(void);
 void trackpad_set_rgb_led (color_t color);
+color_t trackpad_get_rgb_led(void);
 
 #endif /* INC_TRACKPAD_H_ */
@@ -0,0 +1,115 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "accel.h"
+
+/* Below this speed motion is passed through 1:1 */
+#define ACCEL_THRESHOLD_PPS 40
+/* Gain never exceeds 7.0 */
+#define ACCEL_MAX_GAIN_Q8 (7 * ACCEL_GAIN_ONE)
+/* Linear curve: gain rises by 6.0 per 1000 pulses/s above the threshold */
+#define ACCEL_LINEAR_SLOPE_Q8 (6 * ACCEL_GAIN_ONE)
+/* Power curve: gain = 1 + (v / ACCEL_POWER_REF_PPS)^2 */
+#define ACCEL_POWER_REF_PPS 400
+/* Pulse counts are clamped so the velocity product stays within 32 bits */
+#define ACCEL_MAX_PULSES 4000
+
+/* Lookup curve indexed by log2 of the velocity, close to the old step table */
+static const uint16_t accel_lut_q8[32] = {
+    256, 256, 256, 256, 256, 256,   // < 64 pulses/s: 1.0
+    333,                            // < 128: 1.3
+    512,                            // < 256: 2.0
+    768,                            // < 512: 3.0
+    1280,                           // < 1024: 5.0
+    1792, 1792, 1792, 1792, 1792, 1792, 1792, 1792,
+    1792, 1792, 1792, 1792, 1792, 1792, 1792, 1792,
+    1792, 1792, 1792, 1792, 1792, 1792
+};
+
+static volatile accel_curve_t accel_curve = ACCEL_CURVE_LUT;
+
+void accel_configure(accel_curve_t curve)
+{
+    accel_curve = curve;
+}
+
+accel_curve_t accel_get_curve(void)
+{
+    return accel_curve;
+}
+
+uint16_t accel_gain_q8(uint32_t pulses_per_s)
+{
+    uint32_t gain = ACCEL_GAIN_ONE;
+    uint32_t dv;
+
+    if (pulses_per_s <= ACCEL_THRESHOLD_PPS)
+        return ACCEL_GAIN_ONE;
+
+    dv = pulses_per_s - ACCEL_THRESHOLD_PPS;
+
+    switch (accel_curve)
+    {
+        case ACCEL_CURVE_LINEAR:
+            if (dv > 0xFFFF)
+                dv = 0xFFFF;
+            gain += dv * ACCEL_LINEAR_SLOPE_Q8 / 1000;
+            break;
+        case ACCEL_CURVE_POWER:
+            if (dv > 0xFFF)
+                dv = 0xFFF;
+            gain += dv * dv / ((ACCEL_POWER_REF_PPS * ACCEL_POWER_REF_PPS) / ACCEL_GAIN_ONE);
+            break;
+        case ACCEL_CURVE_LUT:
+            gain = accel_lut_q8[31 - __CLZ(pulses_per_s)];
+            break;
+        case ACCEL_CURVE_NONE:
+        default:
+            break;
+    }
+
+    if (gain > ACCEL_MAX_GAIN_Q8)
+        gain = ACCEL_MAX_GAIN_Q8;
+
+    return (uint16_t)gain;
+}
+
+// Scale a pulse count by the gain for the axis velocity, returns whole output units
+int32_t accel_apply(accel_axis_t *axis, int32_t pulses, int32_t step, uint32_t now_us)
+{
+    uint32_t dt = now_us - axis->last_us;
+    uint32_t count = pulses < 0 ? -pulses : pulses;
+    int32_t scaled;
+    int32_t out;
+
+    axis->last_us = now_us;
+
+    if (count > ACCEL_MAX_PULSES)
+        count = ACCEL_MAX_PULSES;
+    if (dt == 0)
+        dt = 1;
+
+    scaled = pulses * step * accel_gain_q8(count * 1000000 / dt) + axis->residue_q8;
+    // Arithmetic shift floors, the residue stays in 0..255 for either direction
+    out = scaled >> 8;
+    axis->residue_q8 = scaled - out * 256;
+
+    return out;
+}
@@ -0,0 +1,104 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "debounce.h"
+
+static uint8_t debounce_press_scans = 1;
+static uint8_t debounce_release_scans = 1;
+static uint8_t debounce_eager_press = 0;
+
+static uint8_t debounce_ctr[64];
+static uint64_t debounce_state = 0;   // debounced output
+static uint64_t debounce_active = 0;  // keys with a running counter
+static uint64_t debounce_lockout = 0; // eagerly pressed keys ignoring the raw input
+
+static uint8_t debounce_ms_to_scans(uint16_t ms, uint16_t scan_rate_hz)
+{
+    uint32_t scans = ((uint32_t)ms * scan_rate_hz + 999) / 1000;
+
+    if (scans < 1)
+        scans = 1;
+    if (scans > 0xFF)
+        scans = 0xFF;
+
+    return (uint8_t)scans;
+}
+
+void debounce_configure(uint16_t press_ms, uint16_t release_ms, uint8_t eager_press, uint16_t scan_rate_hz)
+{
+    debounce_press_scans = debounce_ms_to_scans(press_ms, scan_rate_hz);
+    debounce_release_scans = debounce_ms_to_scans(release_ms, scan_rate_hz);
+    debounce_eager_press = eager_press;
+}
+
+uint64_t debounce_update(uint64_t raw)
+{
+    uint64_t diff = raw ^ debounce_state;
+    uint64_t pending = diff | debounce_active;
+
+    while (pending)
+    {
+        uint8_t bit = (uint8_t)__builtin_ctzll(pending);
+        uint64_t mask = (uint64_t)1 << bit;
+        pending &= pending - 1;
+
+        // Eagerly pressed key, ignore chatter until the lockout expires
+        if (debounce_lockout & mask)
+        {
+            if (++debounce_ctr[bit] >= debounce_press_scans)
+            {
+                debounce_ctr[bit] = 0;
+                debounce_lockout &= ~mask;
+                debounce_active &= ~mask;
+            }
+            continue;
+        }
+
+        // Raw value went back to the debounced one, it was a glitch
+        if (!(diff & mask))
+        {
+            debounce_ctr[bit] = 0;
+            debounce_active &= ~mask;
+            continue;
+        }
+
+        if (debounce_eager_press && (raw & mask))
+        {
+            debounce_state |= mask;
+            debounce_ctr[bit] = 0;
+            debounce_lockout |= mask;
+            debounce_active |= mask;
+            continue;
+        }
+
+        if (++debounce_ctr[bit] >= ((raw & mask) ? debounce_press_scans : debounce_release_scans))
+        {
+            debounce_state ^= mask;
+            debounce_ctr[bit] = 0;
+            debounce_active &= ~mask;
+        }
+        else
+        {
+            debounce_active |= mask;
+        }
+    }
+
+    return debounce_state;
+}
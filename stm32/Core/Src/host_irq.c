@@ -0,0 +1,72 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "host_irq.h"
+#include "key_fifo.h"
+#include "trackpad.h"
+
+/* Level mode reuses the KEYBOARD_IRQ line */
+#define HOST_IRQ_LEVEL_PORT GPIOB
+#define HOST_IRQ_LEVEL_PIN  GPIO_PIN_13
+
+static volatile uint8_t host_irq_mode = HOST_IRQ_DEFAULT_MODE;
+
+uint8_t host_irq_get_mode(void)
+{
+    return host_irq_mode;
+}
+
+void host_irq_set_mode(uint8_t mode)
+{
+    if (mode != HOST_IRQ_MODE_PULSE && mode != HOST_IRQ_MODE_LEVEL)
+        return;
+
+    host_irq_mode = mode;
+
+    if (mode == HOST_IRQ_MODE_LEVEL)
+        host_irq_update();
+    else
+        HAL_GPIO_WritePin(HOST_IRQ_LEVEL_PORT, HOST_IRQ_LEVEL_PIN, GPIO_PIN_RESET);
+}
+
+uint8_t host_irq_status(void)
+{
+    uint8_t status = 0;
+
+    if (key_fifo_count())
+        status |= HOST_IRQ_STATUS_KEY;
+    if (trackpad_report_is_pending())
+        status |= HOST_IRQ_STATUS_TRACKBALL;
+
+    return status;
+}
+
+// Called whenever events are queued or drained, drives the line in level mode
+void host_irq_update(void)
+{
+    if (host_irq_mode != HOST_IRQ_MODE_LEVEL)
+        return;
+
+    // Sample and write in one go, a stale write from a preempted caller could leave the line wrong
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    HOST_IRQ_LEVEL_PORT->BSRR = host_irq_status() ? HOST_IRQ_LEVEL_PIN : (uint32_t)HOST_IRQ_LEVEL_PIN << 16;
+    __set_PRIMASK(primask);
+}
@@ -19,18 +19,38 @@
  */
 
 #include "i2c_slave.h"
-#include "keyboard.h"
+#include "regfile.h"
+#include "trackpad.h"
+#include "host_irq.h"
+#include "profile.h"
 
 I2C_HandleTypeDef hi2c1;
-
-uint8_t I2C_RxData[1];
-
-// volatile because may be accessed from ISR
-volatile uint8_t I2C_Keyboard_TxData[1] = {0x00};
-volatile uint8_t I2C_Trackpad_TxData[4] = {0x00, 0x00, 0x00, 0x00};
-volatile uint8_t i2c_busy = 0;
+#if I2C_SLAVE_TX_DMA
+DMA_HandleTypeDef hdma_i2c1_tx;
+#endif
+
+// [0] = register address, [1] = latest data byte of a write
+uint8_t I2C_RxData[2];
+static uint8_t i2c_rx_stage = 0;
+// Set once the register byte of the current transaction has arrived, cleared at the stop
+static uint8_t i2c_reg_written = 0;
+// Register served by the current read, I2C_RxData[0] may be stale for a bare read
+static uint8_t i2c_tx_reg = 0;
+// Set while a read of plain registers may run on, and while it is still inside the run
+static uint8_t i2c_tx_chain = 0;
+static uint8_t i2c_tx_run = 0;
+
+// Reply of the current read, one register at a time. The HAL sends from it directly.
+static uint8_t I2C_TxData[REGFILE_WINDOW];
+// Trackball report double buffer: the producer fills the back one and flips the index,
+// the address callback snapshots the front one into I2C_TxData. Neither waits.
+static volatile uint8_t I2C_Trackpad_Buf[2][TRACKBALL_REPORT_SIZE];
+static volatile uint8_t i2c_trackpad_front = 0;
 
 void I2C_Error_Handler(void);
+#if I2C_SLAVE_TX_DMA
+static void MX_I2C1_DMA_Init(void);
+#endif
 
 void MX_I2C1_Init_Slave(void)
 {
@@ -50,7 +70,7 @@ void MX_I2C1_Init_Slave(void)
 
     /* Configure I2C1 as slave */
     hi2c1.Instance = I2C1;
-    hi2c1.Init.ClockSpeed = 100000;
+    hi2c1.Init.ClockSpeed = I2C_SLAVE_BUS_HZ;
     hi2c1.Init.DutyCycle = I2C_DUTYCYCLE_2;
     hi2c1.Init.OwnAddress1 = (KEYBOARD_I2C_ADDRESS << 1);
     hi2c1.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
@@ -67,6 +87,10 @@ void MX_I2C1_Init_Slave(void)
     /* Configure analog filter */
     HAL_I2CEx_ConfigAnalogFilter(&hi2c1, I2C_ANALOGFILTER_ENABLE);
 
+#if I2C_SLAVE_TX_DMA
+    MX_I2C1_DMA_Init();
+#endif
+
     /* Enable interrupts */
     HAL_NVIC_SetPriority(I2C1_EV_IRQn, 0, 0);
     HAL_NVIC_EnableIRQ(I2C1_EV_IRQn);
@@ -85,37 +109,121 @@ void MX_I2C1_Init_Slave(void)
     (void)cr1_val; (void)cr2_val; (void)oar1_val; // Prevent optimization
 }
 
-void set_i2c_keyboard_txdata(char c)
+#if I2C_SLAVE_TX_DMA
+static void MX_I2C1_DMA_Init(void)
 {
-	I2C_Keyboard_TxData[0] = c;
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    hdma_i2c1_tx.Instance = DMA1_Stream6;
+    hdma_i2c1_tx.Init.Channel = DMA_CHANNEL_1;
+    hdma_i2c1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_i2c1_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_i2c1_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_i2c1_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_i2c1_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_i2c1_tx.Init.Mode = DMA_NORMAL;
+    hdma_i2c1_tx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_i2c1_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+
+    if (HAL_DMA_Init(&hdma_i2c1_tx) != HAL_OK)
+    {
+        I2C_Error_Handler();
+    }
+
+    __HAL_LINKDMA(&hi2c1, hdmatx, hdma_i2c1_tx);
+
+    HAL_NVIC_SetPriority(DMA1_Stream6_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream6_IRQn);
 }
+#endif
 
-void set_i2c_trackpad_txdata(int16_t dx, int16_t dy)
+// Stream replies are read to the end and may go by DMA. A plain register goes on the
+// interrupt path as a frame of its own, the host may clock on into the next one.
+static void i2c_slave_transmit(I2C_HandleTypeDef *hi2c, uint8_t len, uint8_t stream)
 {
-	I2C_Trackpad_TxData[0] = (dx >> 8) & 0xFF; // dx High Byte
-	I2C_Trackpad_TxData[1] = dx & 0xFF;        // dx Low Byte
-	I2C_Trackpad_TxData[2] = (dy >> 8) & 0xFF; // dy High Byte
-	I2C_Trackpad_TxData[3] = dy & 0xFF;        // dy Low Byte
+#if I2C_SLAVE_TX_DMA
+    if (stream && len >= I2C_SLAVE_DMA_MIN_BYTES)
+    {
+        HAL_I2C_Slave_Seq_Transmit_DMA(hi2c, I2C_TxData, len, I2C_FIRST_AND_LAST_FRAME);
+        return;
+    }
+#endif
+    HAL_I2C_Slave_Seq_Transmit_IT(hi2c, I2C_TxData, len, stream ? I2C_FIRST_AND_LAST_FRAME : I2C_NEXT_FRAME);
 }
 
-void set_i2c_trackpad_mouseclick_txdata(void)
+// The host acked the last byte of a plain register and holds SCL for another one. The HAL
+// has nothing armed and would not answer, so the next register is read only now: a host
+// that NACKs after the register it asked for costs no further handler call.
+static void i2c_slave_transmit_next(I2C_HandleTypeDef *hi2c)
 {
-	I2C_Trackpad_TxData[0] = 0xFF;
-	I2C_Trackpad_TxData[1] = 0xFF;
-	I2C_Trackpad_TxData[2] = 0xFF;
-	I2C_Trackpad_TxData[3] = 0xFF;
+    uint8_t len = 0;
+
+    if (i2c_tx_run && i2c_tx_reg != 0xFF && regfile_is_plain(i2c_tx_reg + 1))
+        len = regfile_read(++i2c_tx_reg, I2C_TxData);
+    else
+        i2c_tx_run = 0;
+
+    // Past the run the host gets zeros rather than a stalled bus
+    if (!len)
+    {
+        I2C_TxData[0] = 0;
+        len = 1;
+    }
+
+    // Writing DR releases SCL, the HAL sends any remaining bytes and stays in listen
+    hi2c->Instance->DR = I2C_TxData[0];
+    if (len > 1)
+        HAL_I2C_Slave_Seq_Transmit_IT(hi2c, &I2C_TxData[1], len - 1, I2C_NEXT_FRAME);
 }
 
-void wait_i2c_busy(void)
+// Single producer (the report timer), the I2C interrupt outranks it so the front buffer
+// is never read while half written
+void set_i2c_trackpad_txdata(int16_t dx, int16_t dy, uint8_t buttons, uint8_t flags)
 {
-    // Only update when not in the middle of I2C transaction
-    while(i2c_busy);
+	volatile uint8_t *back = I2C_Trackpad_Buf[i2c_trackpad_front ^ 1];
+
+	back[0] = TRACKBALL_REPORT_VERSION;
+	back[1] = (dx >> 8) & 0xFF; // dx High Byte
+	back[2] = dx & 0xFF;        // dx Low Byte
+	back[3] = (dy >> 8) & 0xFF; // dy High Byte
+	back[4] = dy & 0xFF;        // dy Low Byte
+	back[5] = buttons;
+	back[6] = flags;
+	i2c_trackpad_front ^= 1;
+}
+
+// Called from the address callback, the producer cannot preempt it
+void get_i2c_trackpad_report(uint8_t *buf)
+{
+	volatile uint8_t *front = I2C_Trackpad_Buf[i2c_trackpad_front];
+
+	for (uint8_t i = 0; i < TRACKBALL_REPORT_SIZE; i++)
+		buf[i] = front[i];
+}
+
+// Legacy 4-byte layout, a press is sent as the all 0xFF click marker
+void get_i2c_trackpad_txdata(uint8_t *buf)
+{
+	volatile uint8_t *front = I2C_Trackpad_Buf[i2c_trackpad_front];
+
+	if ((front[6] & TRACKPAD_FLAG_BUTTONS) && (front[5] & TRACKPAD_BUTTON_LEFT))
+	{
+		buf[0] = buf[1] = buf[2] = buf[3] = 0xFF;
+		return;
+	}
+
+	buf[0] = front[1];
+	buf[1] = front[2];
+	buf[2] = front[3];
+	buf[3] = front[4];
 }
 
 void HAL_I2C_ListenCpltCallback(I2C_HandleTypeDef *hi2c)
 {
-    // Listen completed
-    i2c_busy = 0;
+    // Listen completed, a NACKed read may have drained the last event
+    i2c_reg_written = 0;
+    i2c_tx_chain = 0;
+    host_irq_update();
     HAL_I2C_EnableListen_IT(hi2c);
 }
 
@@ -126,41 +234,70 @@ void HAL_I2C_AddrCallback(I2C_HandleTypeDef *hi2c,
     if (hi2c->Instance != I2C1)
         return;
 
-    i2c_busy = 1;
-
     if (TransferDirection == I2C_DIRECTION_TRANSMIT)
     {
-        // Master is writing to us
+        // Master is writing to us, register address first
+        i2c_rx_stage = 0;
+        i2c_tx_chain = 0;
         HAL_I2C_Slave_Seq_Receive_IT(hi2c, I2C_RxData, 1, I2C_FIRST_AND_LAST_FRAME);
     }
     else
     {
-        // Master is reading from us
-    	if (I2C_RxData[0] == ECHODEV_REG_ADDR_READ_KEYBOARD)
-    	{
-    		HAL_I2C_Slave_Seq_Transmit_IT(hi2c, (uint8_t*)I2C_Keyboard_TxData, 1, I2C_FIRST_AND_LAST_FRAME);
-    	}
-    	else if (I2C_RxData[0] == ECHODEV_REG_ADDR_READ_TRACKBALL)
-    	{
-    		HAL_I2C_Slave_Seq_Transmit_IT(hi2c, (uint8_t*)I2C_Trackpad_TxData, 4, I2C_FIRST_AND_LAST_FRAME);
-    	}
+        // Master is reading from us, reply from the register it just wrote. A bare read
+        // gets the stream register if one is configured, else the last pointer as before.
+        uint8_t reg = I2C_RxData[0];
+        uint8_t len;
+
+        if (!i2c_reg_written && regfile_get_stream_reg())
+            reg = regfile_get_stream_reg();
+        i2c_reg_written = 0;
+        i2c_tx_reg = reg;
+
+        len = regfile_read(reg, I2C_TxData);
+        i2c_tx_chain = !regfile_is_stream(reg);
+        i2c_tx_run = len != 0;
+        if (!len)
+        {
+            I2C_TxData[0] = 0;
+            len = 1;
+        }
+        i2c_slave_transmit(hi2c, len, !i2c_tx_chain);
     }
 }
 
 void HAL_I2C_SlaveRxCpltCallback(I2C_HandleTypeDef *hi2c)
 {
-    // Process received data if needed
-    i2c_busy = 0;
+    if (i2c_rx_stage == 0)
+    {
+        i2c_reg_written = 1;
+        regfile_write_start(I2C_RxData[0]);
+    }
+    else
+        regfile_write_byte(I2C_RxData[1]);
+
+    // Always take one more byte, a repeated start (read) or a stop ends the write.
+    // Arming exactly what a register needs would stall the bus on longer writes.
+    i2c_rx_stage = 1;
+    HAL_I2C_Slave_Seq_Receive_IT(hi2c, &I2C_RxData[1], 1, I2C_FIRST_AND_LAST_FRAME);
 }
 
 void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c)
 {
     // Transmit complete
-    i2c_busy = 0;
+    if (i2c_tx_reg == ECHODEV_REG_ADDR_READ_TRACKBALL || i2c_tx_reg == ECHODEV_REG_ADDR_READ_TRACKBALL_REPORT)
+        trackpad_report_consumed();
+
+    // Drop the level interrupt once the host has drained everything
+    host_irq_update();
 }
 
 void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
 {
+    // The host ended a transfer before the armed length, a NACKed read or a write stopping
+    // short of the byte armed above. The HAL goes on to the listen complete callback.
+    if (HAL_I2C_GetError(hi2c) == HAL_I2C_ERROR_AF)
+        return;
+
     // Disable interrupts during recovery
     __disable_irq();
 
@@ -171,8 +308,6 @@ void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
     HAL_I2C_DeInit(hi2c);
     MX_I2C1_Init_Slave();
 
-    i2c_busy = 0;
-
     __enable_irq();
 }
 
@@ -186,9 +321,23 @@ void I2C_Error_Handler(void)
 
 void I2C1_EV_IRQHandler(void)
 {
+    PROFILE_SCOPE(PROFILE_I2C_EV_ISR);
+    // BTF in listen after a plain register: the HAL would spin on it with nothing to send
+    if (i2c_tx_chain && hi2c1.State == HAL_I2C_STATE_LISTEN && (I2C1->SR1 & I2C_SR1_BTF))
+    {
+        i2c_slave_transmit_next(&hi2c1);
+        return;
+    }
     HAL_I2C_EV_IRQHandler(&hi2c1);
 }
 
+#if I2C_SLAVE_TX_DMA
+void DMA1_Stream6_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_i2c1_tx);
+}
+#endif
+
 void I2C1_ER_IRQHandler(void)
 {
     HAL_I2C_ER_IRQHandler(&hi2c1);
@@ -0,0 +1,94 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "key_fifo.h"
+
+#define KEY_FIFO_MASK (KEY_FIFO_SIZE - 1)
+
+#if (KEY_FIFO_SIZE & KEY_FIFO_MASK) || (KEY_FIFO_SIZE > 128)
+#error "KEY_FIFO_SIZE must be a power of two, at most 128"
+#endif
+
+static uint8_t key_fifo_buf[KEY_FIFO_SIZE];
+static uint32_t key_fifo_time[KEY_FIFO_SIZE];
+
+// Free-running indices: head is written by the producer only, tail by the consumer only
+static volatile uint8_t key_fifo_head = 0;
+static volatile uint8_t key_fifo_tail = 0;
+
+// Saturating count of keys dropped because the host did not drain the FIFO in time
+static volatile uint8_t key_fifo_overflow = 0;
+
+// Producer side, returns 0 if the FIFO was full and the key was dropped
+uint8_t key_fifo_push(uint8_t key, uint32_t time_us)
+{
+    uint8_t head = key_fifo_head;
+
+    if ((uint8_t)(head - key_fifo_tail) >= KEY_FIFO_SIZE)
+    {
+        if (key_fifo_overflow < 0xFF)
+            key_fifo_overflow++;
+        return 0;
+    }
+
+    key_fifo_buf[head & KEY_FIFO_MASK] = key;
+    key_fifo_time[head & KEY_FIFO_MASK] = time_us;
+
+    // Make sure the entry is visible before the consumer sees the new head
+    __DMB();
+    key_fifo_head = head + 1;
+
+    return 1;
+}
+
+// Consumer side, returns 0 if the FIFO is empty, time_us may be NULL
+uint8_t key_fifo_pop(uint8_t *key, uint32_t *time_us)
+{
+    uint8_t tail = key_fifo_tail;
+
+    if (tail == key_fifo_head)
+        return 0;
+
+    *key = key_fifo_buf[tail & KEY_FIFO_MASK];
+    if (time_us)
+        *time_us = key_fifo_time[tail & KEY_FIFO_MASK];
+
+    // Entry must be read before the producer is allowed to reuse the slot
+    __DMB();
+    key_fifo_tail = tail + 1;
+
+    return 1;
+}
+
+uint8_t key_fifo_count(void)
+{
+    return (uint8_t)(key_fifo_head - key_fifo_tail);
+}
+
+uint8_t key_fifo_overflow_count(void)
+{
+    return key_fifo_overflow;
+}
+
+// Consumer side, drops everything currently queued
+void key_fifo_flush(void)
+{
+    key_fifo_tail = key_fifo_head;
+}
@@ -19,11 +19,24 @@
  */
 
 #include "keyboard.h"
+#include "key_fifo.h"
+#include "debounce.h"
+#include "timebase.h"
+#include "host_irq.h"
+#include "profile.h"
 
 /* Definitions */
 #define NUM_COLS 5
 #define NUM_ROWS 7
-#define PRESS_AND_HOLD_COUNT 50
+
+/* Scan engine timing, all expressed in full matrix scans */
+#define KEYBOARD_MS_TO_SCANS(ms, hz)  ((uint32_t)(ms) * (hz) / 1000)
+
+/* Scan timer, one column is driven per timer period */
+#define SCAN_TIMER                TIM3
+#define SCAN_TIMER_IRQn           TIM3_IRQn
+#define SCAN_TIMER_TICK_HZ        1000000  // 1 us timer resolution
+#define SCAN_TIMER_PERIOD_US(hz)  (SCAN_TIMER_TICK_HZ / ((hz) * NUM_COLS))
 
 /* Special characters */
 #define S_ALT    'a'
@@ -44,12 +57,43 @@
 #define ROW_SYM     2
 #define COL_SYM     0
 
+/*
+ * Packed matrix: one byte per column in a 64-bit word, bit r of byte c is row r.
+ * Changed keys come from old ^ new and are walked with count-trailing-zeros,
+ * which visits them in the same column-major order as the matrix scan.
+ */
+#define KEY_BIT_INDEX(r, c)  ((c) * 8 + (r))
+#define KEY_BIT(r, c)        ((uint64_t)1 << KEY_BIT_INDEX(r, c))
+#define KEY_BIT_ROW(bit)     ((bit) & 7)
+#define KEY_BIT_COL(bit)     ((bit) >> 3)
+
+#define MODIFIER_KEYS_MASK   (KEY_BIT(ROW_ALT, COL_ALT) | KEY_BIT(ROW_RSHIFT, COL_RSHIFT) | \
+                              KEY_BIT(ROW_LSHIFT, COL_LSHIFT) | KEY_BIT(ROW_SYM, COL_SYM))
+
 /* Port and pin definitions */
 GPIO_TypeDef* col_ports[NUM_COLS] = {GPIOA,      GPIOA,      GPIOA,       GPIOA,       GPIOA     };
 uint16_t      col_pins[NUM_COLS]  = {GPIO_PIN_0, GPIO_PIN_1, GPIO_PIN_2,  GPIO_PIN_3,  GPIO_PIN_4 };
 
-GPIO_TypeDef* row_ports[NUM_ROWS] = {GPIOB,      GPIOB,      GPIOA,       GPIOB,       GPIOC,       GPIOB,       GPIOB       };
-uint16_t      row_pins[NUM_ROWS]  = {GPIO_PIN_0, GPIO_PIN_1, GPIO_PIN_12, GPIO_PIN_3,  GPIO_PIN_15, GPIO_PIN_5,  GPIO_PIN_15 };
+/* Row wiring as X(row, port letter, pin number), row_ports/row_pins and the port-wide gather are generated from it */
+#define KEYBOARD_ROWS(X) \
+    X(0, B, 0)           \
+    X(1, B, 1)           \
+    X(2, A, 12)          \
+    X(3, B, 3)           \
+    X(4, C, 15)          \
+    X(5, B, 5)           \
+    X(6, B, 15)
+
+#define ROW_PORT(r, port, pin)  GPIO##port,
+#define ROW_PIN(r, port, pin)   GPIO_PIN_##pin,
+
+GPIO_TypeDef* row_ports[NUM_ROWS] = { KEYBOARD_ROWS(ROW_PORT) };
+uint16_t      row_pins[NUM_ROWS]  = { KEYBOARD_ROWS(ROW_PIN) };
+
+#if !KEYBOARD_SCAN_USE_HAL
+/* Moves input bit 'pin' of the port's IDR snapshot to bit 'r' of the row mask, folded at compile time */
+#define ROW_GATHER(r, port, pin) | (((idr_##port >> (pin)) & 1u) << (r))
+#endif
 
 GPIO_TypeDef*    keyboard_irq_port = GPIOB;
 const uint16_t   keyboard_irq_pin  = GPIO_PIN_13;
@@ -79,7 +123,9 @@ const char alt_key_mapping[NUM_ROWS][NUM_COLS] = {
 
 /* Global variables */
 // Following are volatile mostly because of live debugging purposes
-volatile uint8_t key_state[NUM_ROWS][NUM_COLS];
+volatile uint64_t key_state = 0;
+uint64_t key_pressed_mask = 0; // keys keyboard_find_key() should consider
+volatile uint32_t ghost_events = 0; // number of scans where phantom keys were suppressed
 volatile uint8_t key_changed = 0;
 volatile char key_pressed_end_result = 0;
 volatile char last_pressed_key = 0;
@@ -90,6 +136,36 @@ volatile uint8_t lshift_key_pressed = 0;
 
 uint8_t press_and_hold_active = 0;
 volatile uint8_t caps_lock_mode = 0;
+volatile uint8_t keyboard_mode = KEYBOARD_MODE_ASCII;
+
+// Scan engine state, owned by the scan timer ISR
+static uint8_t scan_col = 0;
+static uint8_t scan_col_driven = 0;
+static uint64_t scan_buf = 0;
+
+// Last complete matrix published by the scan timer ISR
+static volatile uint64_t scan_snapshot = 0;
+static volatile uint32_t scan_snapshot_us = 0;
+static volatile uint8_t scan_snapshot_ready = 0;
+
+// Time of the snapshot last consumed by keyboard_scan(), stamps the keys it produces
+static uint32_t key_scan_us = 0;
+
+// Remaining scan timer periods of the current IRQ pulse
+static volatile uint8_t irq_pulse_ticks = 0;
+
+// Runtime configuration and the timing derived from it by keyboard_apply_config()
+static keyboard_config_t keyboard_config = {
+    KEYBOARD_SCAN_RATE_HZ,
+    KEYBOARD_DEBOUNCE_PRESS_MS,
+    KEYBOARD_DEBOUNCE_RELEASE_MS,
+    KEYBOARD_DEBOUNCE_EAGER_PRESS,
+    KEYBOARD_HOLD_DELAY_MS,
+    KEYBOARD_REPEAT_INTERVAL_MS,
+};
+static volatile uint16_t hold_delay_scans;
+static volatile uint16_t repeat_interval_scans;
+static volatile uint8_t irq_pulse_period_ticks;
 
 /* Functions */
 static uint8_t is_lowercase(char c)
@@ -124,66 +200,151 @@ static char to_lowercase (char c)
     return c + 32;
 }
 
-char keyboard_find_key()
+static inline uint8_t keyboard_next_bit(uint64_t *mask)
+{
+    uint8_t bit = (uint8_t)__builtin_ctzll(*mask);
+    *mask &= *mask - 1;
+    return bit;
+}
+
+/*
+ * The matrix has no diodes: with three corners of a row/column rectangle pressed,
+ * the fourth reads as pressed too. Two columns sharing two or more rows form such a
+ * rectangle, and none of its corners can be trusted.
+ */
+static uint64_t keyboard_ghost_mask(uint64_t state)
 {
-    // Fill in key_pressed_end_result based on the GPIO matrix, identify additional keys pressed
-    for (int c = 0; c < NUM_COLS; c++)
+    uint64_t ghost = 0;
+
+    for (int c1 = 0; c1 < NUM_COLS - 1; c1++)
     {
-        for (int r = 0; r < NUM_ROWS; r++)
+        uint8_t rows1 = (uint8_t)(state >> KEY_BIT_INDEX(0, c1));
+
+        // A single key in this column cannot be part of a rectangle
+        if (!(rows1 & (rows1 - 1)))
+            continue;
+
+        for (int c2 = c1 + 1; c2 < NUM_COLS; c2++)
         {
-            if (key_state[r][c])
+            uint8_t shared = rows1 & (uint8_t)(state >> KEY_BIT_INDEX(0, c2));
+
+            if (shared & (shared - 1))
             {
-            	// if alt, left shift, or right shift, we already set the flag in keyboard_scan()
-                if (key_mapping[r][c] == S_ALT ||
-                    key_mapping[r][c] == S_RSHIFT ||
-                    key_mapping[r][c] == S_LSHIFT ||
-					key_mapping[r][c] == S_SYM)
-                {
-                    return S_UNUSED;
-                }
-
-                else if (alt_key_pressed)
-                {
-                    if (alt_key_mapping[r][c] != S_UNUSED)
-                        key_pressed_end_result = alt_key_mapping[r][c];
-                    else
-                        key_pressed_end_result = key_mapping[r][c];
-
-					alt_key_pressed = 0;
-					rshift_key_pressed = 0;
-					lshift_key_pressed = 0;
-                }
-                else if (rshift_key_pressed || lshift_key_pressed || caps_lock_mode)
-                {
-                    if (is_lowercase(key_pressed_end_result))
-                    {
-                        key_pressed_end_result = to_capitalletter(key_mapping[r][c]);
-                    }
-                    else
-                    {
-                        key_pressed_end_result = key_mapping[r][c];
-                    }
-
-					alt_key_pressed = 0;
-					rshift_key_pressed = 0;
-					lshift_key_pressed = 0;
-                }
-                else if (is_uppercase(key_mapping[r][c]))
-                {
-                    key_pressed_end_result = to_lowercase(key_mapping[r][c]);
-                }
-                else
-                {
-                    key_pressed_end_result = key_mapping[r][c];
-                }
-
-                last_pressed_key = key_pressed_end_result;
+                ghost |= ((uint64_t)shared << KEY_BIT_INDEX(0, c1)) |
+                         ((uint64_t)shared << KEY_BIT_INDEX(0, c2));
             }
         }
-     }
+    }
+
+    return ghost;
+}
+
+static uint8_t is_modifier_key(int r, int c)
+{
+    return key_mapping[r][c] == S_ALT ||
+           key_mapping[r][c] == S_RSHIFT ||
+           key_mapping[r][c] == S_LSHIFT ||
+           key_mapping[r][c] == S_SYM;
+}
+
+// Resolve one non-modifier key against sticky (or, in rollover mode, held) modifiers
+static char keyboard_resolve_key(int r, int c)
+{
+    uint8_t alt = alt_key_pressed;
+    uint8_t shift = rshift_key_pressed || lshift_key_pressed;
+
+#if KEYBOARD_NKRO
+    // Chords: modifiers held together with the key apply as well
+    alt |= (key_state & KEY_BIT(ROW_ALT, COL_ALT)) != 0;
+    shift |= (key_state & (KEY_BIT(ROW_RSHIFT, COL_RSHIFT) | KEY_BIT(ROW_LSHIFT, COL_LSHIFT))) != 0;
+#endif
+
+    if (alt)
+    {
+        if (alt_key_mapping[r][c] != S_UNUSED)
+            key_pressed_end_result = alt_key_mapping[r][c];
+        else
+            key_pressed_end_result = key_mapping[r][c];
+
+        alt_key_pressed = 0;
+        rshift_key_pressed = 0;
+        lshift_key_pressed = 0;
+    }
+    else if (shift || caps_lock_mode)
+    {
+        if (is_lowercase(key_pressed_end_result))
+        {
+            key_pressed_end_result = to_capitalletter(key_mapping[r][c]);
+        }
+        else
+        {
+            key_pressed_end_result = key_mapping[r][c];
+        }
+
+        alt_key_pressed = 0;
+        rshift_key_pressed = 0;
+        lshift_key_pressed = 0;
+    }
+    else if (is_uppercase(key_mapping[r][c]))
+    {
+        key_pressed_end_result = to_lowercase(key_mapping[r][c]);
+    }
+    else
+    {
+        key_pressed_end_result = key_mapping[r][c];
+    }
+
+    last_pressed_key = key_pressed_end_result;
+
+    return last_pressed_key;
+}
+
+#if KEYBOARD_NKRO
+// Rollover: returns one character per newly pressed key, call until it returns S_UNUSED
+char keyboard_find_key()
+{
+    while (key_pressed_mask)
+    {
+        uint8_t bit = keyboard_next_bit(&key_pressed_mask);
+        int r = KEY_BIT_ROW(bit);
+        int c = KEY_BIT_COL(bit);
+
+        // Modifier flags were already updated in keyboard_scan()
+        if (is_modifier_key(r, c))
+            continue;
+
+        return keyboard_resolve_key(r, c);
+    }
+
+    return S_UNUSED;
+}
+#else
+char keyboard_find_key()
+{
+    uint64_t pending = key_pressed_mask;
+
+    key_pressed_mask = 0;
+
+    if (!pending)
+        return S_UNUSED;
+
+    // Fill in key_pressed_end_result from the newly pressed (or held, when repeating) keys
+    while (pending)
+    {
+        uint8_t bit = keyboard_next_bit(&pending);
+        int r = KEY_BIT_ROW(bit);
+        int c = KEY_BIT_COL(bit);
+
+        // if alt, left shift, or right shift, we already set the flag in keyboard_scan()
+        if (is_modifier_key(r, c))
+            return S_UNUSED;
+
+        keyboard_resolve_key(r, c);
+    }
 
     return last_pressed_key;
 }
+#endif
 
 void keyboard_row_test(void)
 {
@@ -235,84 +396,251 @@ void keyboard_init(void)
 	GPIO_InitStruct.Pin = keyboard_irq_pin;
 	HAL_GPIO_Init(keyboard_irq_port, &GPIO_InitStruct);
 	HAL_GPIO_WritePin(keyboard_irq_port, keyboard_irq_pin, GPIO_PIN_RESET);
+
+	// Start the timer-paced matrix scan
+	keyboard_scan_timer_init();
+}
+
+// Derive the scan based timing from keyboard_config, the scan timer must be initialised
+static void keyboard_apply_config(void)
+{
+    uint16_t hz = keyboard_config.scan_rate_hz;
+    uint32_t period_us = SCAN_TIMER_PERIOD_US(hz);
+    uint32_t repeat = KEYBOARD_MS_TO_SCANS(keyboard_config.repeat_interval_ms, hz);
+
+    debounce_configure(keyboard_config.debounce_press_ms, keyboard_config.debounce_release_ms,
+                       keyboard_config.debounce_eager_press, hz);
+
+    hold_delay_scans = KEYBOARD_MS_TO_SCANS(keyboard_config.hold_delay_ms, hz);
+    repeat_interval_scans = repeat ? repeat : 1;
+    if (repeat_interval_scans > hold_delay_scans)
+        hold_delay_scans = repeat_interval_scans;
+    irq_pulse_period_ticks = (KEYBOARD_IRQ_PULSE_US + period_us - 1) / period_us + 1;
+
+    SCAN_TIMER->ARR = period_us - 1;
+}
+
+void keyboard_scan_timer_init(void)
+{
+    __HAL_RCC_TIM3_CLK_ENABLE();
+
+    // Update event starts a column, compare channel 1 samples it after the settle time
+    SCAN_TIMER->CR1  = 0;
+    SCAN_TIMER->PSC  = timebase_apb1_timer_clock() / SCAN_TIMER_TICK_HZ - 1;
+    SCAN_TIMER->CCR1 = KEYBOARD_SCAN_SETTLE_US;
+    keyboard_apply_config();
+    SCAN_TIMER->EGR  = TIM_EGR_UG;
+    SCAN_TIMER->SR   = 0;
+    SCAN_TIMER->DIER = TIM_DIER_UIE | TIM_DIER_CC1IE;
+
+    // Lower priority than I2C and trackball EXTIs
+    HAL_NVIC_SetPriority(SCAN_TIMER_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(SCAN_TIMER_IRQn);
+
+    // ARR is preloaded so a runtime rate change never lets the counter run past it
+    SCAN_TIMER->CR1 = TIM_CR1_ARPE | TIM_CR1_CEN;
+}
+
+static void keyboard_scan_tick_sample(void)
+{
+    if (!scan_col_driven)
+        return;
+
+    uint8_t rows = 0;
+
+#if KEYBOARD_SCAN_USE_HAL
+    for (int r = 0; r < NUM_ROWS; r++)
+    {
+        if (HAL_GPIO_ReadPin(row_ports[r], row_pins[r]) == GPIO_PIN_RESET)
+            rows |= (1 << r);
+    }
+
+    HAL_GPIO_WritePin(col_ports[scan_col], col_pins[scan_col], GPIO_PIN_SET);
+#else
+    // One IDR read per port, rows are active low
+    uint32_t idr_A = GPIOA->IDR;
+    uint32_t idr_B = GPIOB->IDR;
+    uint32_t idr_C = GPIOC->IDR;
+
+    rows = (uint8_t)(~(0 KEYBOARD_ROWS(ROW_GATHER)) & ((1 << NUM_ROWS) - 1));
+
+    col_ports[scan_col]->BSRR = col_pins[scan_col];
+#endif
+
+    scan_buf |= (uint64_t)rows << KEY_BIT_INDEX(0, scan_col);
+
+    scan_col_driven = 0;
+
+    if (++scan_col >= NUM_COLS)
+    {
+        // Full matrix done, debounce per key and publish snapshot for keyboard_scan()
+        scan_col = 0;
+        scan_snapshot = debounce_update(scan_buf);
+        scan_snapshot_us = timebase_us();
+        scan_snapshot_ready = 1;
+        scan_buf = 0;
+    }
+}
+
+static void keyboard_scan_tick_drive(void)
+{
+    if (scan_col_driven)
+        return;
+
+#if KEYBOARD_SCAN_USE_HAL
+    HAL_GPIO_WritePin(col_ports[scan_col], col_pins[scan_col], GPIO_PIN_RESET);
+#else
+    col_ports[scan_col]->BSRR = (uint32_t)col_pins[scan_col] << 16;
+#endif
+    scan_col_driven = 1;
+}
+
+void TIM3_IRQHandler(void)
+{
+    PROFILE_SCOPE(PROFILE_SCAN_ISR);
+    uint32_t sr = SCAN_TIMER->SR;
+    SCAN_TIMER->SR = ~(sr & (TIM_SR_UIF | TIM_SR_CC1IF));
+
+    // Sample before driving so that a late ISR still finishes the previous column first
+    if (sr & TIM_SR_CC1IF)
+        keyboard_scan_tick_sample();
+
+    if (sr & TIM_SR_UIF)
+    {
+        keyboard_scan_tick_drive();
+
+        if (irq_pulse_ticks && --irq_pulse_ticks == 0)
+            HAL_GPIO_WritePin(keyboard_irq_port, keyboard_irq_pin, GPIO_PIN_RESET);
+    }
 }
 
 void keyboard_scan(void)
 {
-	static uint8_t press_and_hold_ctr = 0;
-    uint8_t new_state[NUM_ROWS][NUM_COLS] = {0};
-    uint8_t any_key_pressed = 0;
+    static uint16_t press_and_hold_ctr = 0;
+#if KEYBOARD_NKRO
+    static uint64_t repeat_key_mask = 0;
+#endif
+    uint64_t new_state;
+    uint64_t changed;
+    PROFILE_SCOPE(PROFILE_KEYBOARD_SCAN);
 
     key_changed = 0;
 
-    for (int c = 0; c < NUM_COLS; c++)
-    {
-        HAL_GPIO_WritePin(col_ports[c], col_pins[c], GPIO_PIN_RESET);
+    // Non-blocking: nothing to do until the scan timer has published a new matrix
+    if (!scan_snapshot_ready)
+        return;
 
-        HAL_Delay(1);
+    __disable_irq();
+    new_state = scan_snapshot;
+    key_scan_us = scan_snapshot_us;
+    scan_snapshot_ready = 0;
+    __enable_irq();
 
-        for (int r = 0; r < NUM_ROWS; r++) {
-            new_state[r][c] = (HAL_GPIO_ReadPin(row_ports[r], row_pins[r]) == GPIO_PIN_RESET);
+    // Ambiguous rectangle corners keep their previous state, so real chords still work
+    uint64_t ghost = keyboard_ghost_mask(new_state);
+    if (ghost)
+    {
+        new_state = (new_state & ~ghost) | (key_state & ghost);
+        ghost_events++;
+    }
 
-            if (new_state[r][c]) {
-                any_key_pressed = 1;  // track if any key is pressed, this is to make sure if all zeros (all keys released), we dont send anything
-            }
+    changed = key_state ^ new_state;
+    key_state = new_state;
 
-            if (new_state[r][c] != key_state[r][c])
-            {
-                key_state[r][c] = new_state[r][c];
-                key_changed = 1;
-            }
+    // Raw mode: queue a press/release event per changed key, the host handles modifiers and repeat
+    if (keyboard_mode == KEYBOARD_MODE_RAW)
+    {
+        while (changed)
+        {
+            uint8_t bit = keyboard_next_bit(&changed);
+            uint8_t code = KEY_BIT_ROW(bit) * NUM_COLS + KEY_BIT_COL(bit) + 1;
+
+            key_fifo_push(((new_state >> bit) & 1 ? KEYBOARD_RAW_PRESSED : 0) | code, key_scan_us);
+            key_changed = 1;
         }
 
-        HAL_GPIO_WritePin(col_ports[c], col_pins[c], GPIO_PIN_SET);
+        return;
     }
 
+    // Only newly pressed keys produce a character, releases never do
+    key_pressed_mask = changed & new_state;
+    key_changed = (key_pressed_mask != 0);
+
+#if KEYBOARD_NKRO
+    if (key_pressed_mask & ~MODIFIER_KEYS_MASK)
+        repeat_key_mask = (uint64_t)1 << (63 - __builtin_clzll(key_pressed_mask & ~MODIFIER_KEYS_MASK));
+#endif
+
     // If all keys are released (all zeros), do not mark as changed (key_changed=0).
-    // At the same time, detect press_and_hold situation and register key (key_changed=1) if certain amount of holds have occured (press_and_hold_ctr > PRESS_AND_HOLD_COUNT)
-    if (!any_key_pressed) {
+    // At the same time, detect press_and_hold situation and register key (key_changed=1) every repeat_interval_scans once held for hold_delay_scans
+    if (!new_state) {
         key_changed = 0;
         press_and_hold_ctr = 0;
         press_and_hold_active = 0;
     }
+    else if (changed)
+    {
+        press_and_hold_ctr = 0;
+    }
     else
     {
-    	press_and_hold_ctr++;
-    	if (press_and_hold_ctr > PRESS_AND_HOLD_COUNT)
-    	{
-    		press_and_hold_active = 1;
-    		key_changed = 1;
-    	}
+        // Both may be rewritten by the I2C slave in between, never let the counter wrap
+        uint16_t hold = hold_delay_scans;
+        uint16_t repeat = repeat_interval_scans;
+
+        press_and_hold_ctr++;
+        if (press_and_hold_ctr >= hold)
+        {
+            press_and_hold_active = 1;
+            press_and_hold_ctr = (hold > repeat) ? hold - repeat : 0;
+#if KEYBOARD_NKRO
+            // Only the most recently pressed key repeats
+            key_pressed_mask = repeat_key_mask & new_state;
+            key_changed = (key_pressed_mask != 0);
+#else
+            key_pressed_mask = new_state;
+            key_changed = 1;
+#endif
+        }
     }
 
+#if KEYBOARD_NKRO
+    // Modifiers arm their sticky flag on the press edge, modifiers still held
+    // when a key is pressed are applied as a chord by keyboard_resolve_key()
+    if (changed & new_state & KEY_BIT(ROW_ALT, COL_ALT))
+        alt_key_pressed = 1;
+    if (changed & new_state & KEY_BIT(ROW_RSHIFT, COL_RSHIFT))
+        rshift_key_pressed = 1;
+    if (changed & new_state & KEY_BIT(ROW_LSHIFT, COL_LSHIFT))
+        lshift_key_pressed = 1;
+    if (changed & new_state & KEY_BIT(ROW_SYM, COL_SYM))  // sym will activate caps lock mode
+        caps_lock_mode = !caps_lock_mode;
+#else
     // If alt, rshift, or lshift is pressed, do not mark as changed
-    if (key_state[ROW_ALT][COL_ALT])
+    if (key_state & KEY_BIT(ROW_ALT, COL_ALT))
     {
         key_changed = 0;
         alt_key_pressed = 1;
     }
-    else if (key_state[ROW_RSHIFT][COL_RSHIFT])
+    else if (key_state & KEY_BIT(ROW_RSHIFT, COL_RSHIFT))
     {
         key_changed = 0;
         rshift_key_pressed = 1;
     }
-    else if (key_state[ROW_LSHIFT][COL_LSHIFT])
+    else if (key_state & KEY_BIT(ROW_LSHIFT, COL_LSHIFT))
     {
         key_changed = 0;
         lshift_key_pressed = 1;
     }
-    else if (key_state[ROW_SYM][COL_SYM])  // sym will activate caps lock mode
+    else if (key_state & KEY_BIT(ROW_SYM, COL_SYM))  // sym will activate caps lock mode
 	{
-		if(caps_lock_mode)
-			caps_lock_mode = 0;
-		else
-			caps_lock_mode = 1;
+		// Toggle on the press edge only, holding sym does not toggle again
+		if (changed & KEY_BIT(ROW_SYM, COL_SYM))
+			caps_lock_mode = !caps_lock_mode;
 
 		key_changed = 0;
-
-		// Debounce caps lock mode to avoid toggling rapidly
-		HAL_Delay(500);
 	}
+#endif
 }
 
 uint8_t keyboard_is_key_changed()
@@ -320,11 +648,65 @@ uint8_t keyboard_is_key_changed()
     return key_changed;
 }
 
+uint8_t keyboard_get_mode(void)
+{
+    return keyboard_mode;
+}
+
+void keyboard_set_mode(uint8_t mode)
+{
+    if (mode != KEYBOARD_MODE_ASCII && mode != KEYBOARD_MODE_RAW)
+        return;
+
+    // Sticky modifiers only make sense in ASCII mode
+    alt_key_pressed = 0;
+    rshift_key_pressed = 0;
+    lshift_key_pressed = 0;
+    caps_lock_mode = 0;
+
+    keyboard_mode = mode;
+}
+
+// Time of the matrix scan behind the keys returned by keyboard_find_key()
+uint32_t keyboard_get_scan_time(void)
+{
+	return key_scan_us;
+}
+
+void keyboard_get_config(keyboard_config_t *cfg)
+{
+	*cfg = keyboard_config;
+}
+
+// Takes effect from the next scan period, the matrix scan itself is not restarted
+void keyboard_set_config(const keyboard_config_t *cfg)
+{
+	if (cfg->scan_rate_hz < KEYBOARD_SCAN_RATE_MIN_HZ || cfg->scan_rate_hz > KEYBOARD_SCAN_RATE_MAX_HZ)
+		return;
+	if (cfg->hold_delay_ms > KEYBOARD_HOLD_DELAY_MAX_MS || cfg->repeat_interval_ms > cfg->hold_delay_ms)
+		return;
+	if (cfg->debounce_eager_press > 1)
+		return;
+
+	keyboard_config = *cfg;
+	keyboard_apply_config();
+}
+
 void keyboard_generate_irq_pulse(void)
 {
-	// Pulse on interrupt output pin KEY_CHANGED_IRQ
+	// Level mode holds the line while keys are queued instead of pulsing it
+	if (host_irq_get_mode() == HOST_IRQ_MODE_LEVEL)
+	{
+		host_irq_update();
+		return;
+	}
+
+	// A pulse still in progress already signals the host, which drains the whole FIFO
+	if (irq_pulse_ticks)
+		return;
+
+	// Pulse on interrupt output pin KEY_CHANGED_IRQ, the scan timer ISR ends it
+	irq_pulse_ticks = irq_pulse_period_ticks;
 	HAL_GPIO_WritePin(keyboard_irq_port, keyboard_irq_pin, GPIO_PIN_SET);
-	HAL_Delay(1);
-	HAL_GPIO_WritePin(keyboard_irq_port, keyboard_irq_pin, GPIO_PIN_RESET);
 }
 
@@ -22,6 +22,9 @@
 #include "keyboard.h"
 #include "i2c_slave.h"
 #include "trackpad.h"
+#include "key_fifo.h"
+#include "timebase.h"
+#include "profile.h"
 
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
@@ -36,6 +39,10 @@ int main(void)
 
     MX_I2C1_Init_Slave();
 
+    timebase_init();
+
+    profile_init();
+
     keyboard_init();
 
     trackpad_init();
@@ -46,47 +53,45 @@ int main(void)
 
     while (1)
     {
-    	// --------- Trackpad ---------------------------
-    	static int16_t dx, dy;
-    	static uint8_t btn;
-    	trackpad_get_deltas(&dx, &dy, &btn);
-    	if (dx || dy)
-    	{
-    		wait_i2c_busy();
-    		set_i2c_trackpad_txdata(dx, dy);
-    		trackpad_generate_irq_pulse();
-    	}
-
-    	if (btn)
-    	{
-    		uint32_t t = HAL_GetTick();
-    		static uint32_t last_trackpad_btn_tick = 0;
-    		if (t - last_trackpad_btn_tick >= TRACKPAD_BTN_DEBOUNCE_MS)
-    		{
-    			last_trackpad_btn_tick = t;
-    			wait_i2c_busy();
-    			set_i2c_trackpad_mouseclick_txdata();
-    			trackpad_generate_irq_pulse();
-    		}
-    	}
-
+    	// Trackball reports are published by the report timer in trackpad.c
     	// --------- Keyboard ---------------------------
+        static uint32_t last_keyboard_irq_tick = 0;
+
+        // Consumes the latest matrix published by the scan timer, returns immediately otherwise
         keyboard_scan();
 
         if (keyboard_is_key_changed())
         {
-            char pressed = keyboard_find_key();
+            // In raw mode keyboard_scan() has already queued the press/release events
+            uint8_t queued = (keyboard_get_mode() == KEYBOARD_MODE_RAW);
 
-            if (pressed)
+            if (!queued)
+            {
+            	char pressed;
+
+            	// With rollover every newly pressed key yields one character
+            	while ((pressed = keyboard_find_key()))
+            	{
+            		// Queue for the host, no need to wait for the previous key to be read
+            		key_fifo_push(pressed, keyboard_get_scan_time());
+            		queued = 1;
+            	}
+            }
+
+            if (queued)
             {
-            	wait_i2c_busy();
-            	set_i2c_keyboard_txdata(pressed);
             	keyboard_generate_irq_pulse();
+            	last_keyboard_irq_tick = HAL_GetTick();
             }
         }
-        // -----------------------------------------------
 
-        HAL_Delay(10); // debounce/scan interval
+        // Re-signal the host if keys are still queued, in case an edge was missed
+        if (key_fifo_count() && (HAL_GetTick() - last_keyboard_irq_tick >= KEYBOARD_IRQ_RETRIGGER_MS))
+        {
+            keyboard_generate_irq_pulse();
+            last_keyboard_irq_tick = HAL_GetTick();
+        }
+        // -----------------------------------------------
     }
 }
 
@@ -106,7 +111,17 @@ void SystemClock_Config(void)
     RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
     RCC_OscInitStruct.HSIState = RCC_HSI_ON;
     RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
+#if SYSCLK_PROFILE == SYSCLK_PROFILE_PLL_100MHZ
+    // 16 MHz / 8 = 2 MHz VCO input (lowest jitter), * 100 = 200 MHz VCO, / 2 = 100 MHz
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+    RCC_OscInitStruct.PLL.PLLM = 8;
+    RCC_OscInitStruct.PLL.PLLN = 100;
+    RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
+    RCC_OscInitStruct.PLL.PLLQ = 4;
+#else
     RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
+#endif
     if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
     {
         Error_Handler();
@@ -116,15 +131,32 @@ void SystemClock_Config(void)
     */
     RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
                                 |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
     RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
-    RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
     RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+#if SYSCLK_PROFILE == SYSCLK_PROFILE_PLL_100MHZ
+    // APB1 is limited to 50 MHz, its timers still run at 100 MHz (see timebase_apb1_timer_clock)
+    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+    RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV2;
+
+    // 3 wait states at 90-100 MHz and 2.7-3.6 V
+    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_3) != HAL_OK)
+    {
+        Error_Handler();
+    }
+#else
+    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+    RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
 
     if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
     {
         Error_Handler();
     }
+#endif
+
+    // ART accelerator, hides the flash wait states (also set by HAL_Init() from hal_conf)
+    __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
 }
 
 static void MX_GPIO_Init(void)
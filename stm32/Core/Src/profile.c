@@ -0,0 +1,75 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "profile.h"
+
+static profile_stats_t profile_stats[PROFILE_PROBE_COUNT];
+
+void profile_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    profile_reset();
+}
+
+void profile_record(profile_probe_t probe, uint32_t cycles)
+{
+    profile_stats_t *st = &profile_stats[probe];
+    uint32_t primask = __get_PRIMASK();
+
+    // The I2C interrupt reads the stats and preempts every other probe
+    __disable_irq();
+    st->count++;
+    st->total += cycles;
+    if (cycles < st->min)
+        st->min = cycles;
+    if (cycles > st->max)
+        st->max = cycles;
+    __set_PRIMASK(primask);
+}
+
+void profile_get(profile_probe_t probe, profile_stats_t *stats)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    *stats = profile_stats[probe];
+    __set_PRIMASK(primask);
+
+    if (stats->count == 0)
+        stats->min = 0;
+}
+
+void profile_reset(void)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    for (int i = 0; i < PROFILE_PROBE_COUNT; i++)
+    {
+        profile_stats[i].count = 0;
+        profile_stats[i].min = UINT32_MAX;
+        profile_stats[i].max = 0;
+        profile_stats[i].total = 0;
+    }
+    __set_PRIMASK(primask);
+}
@@ -0,0 +1,461 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "regfile.h"
+#include "i2c_slave.h"
+#include "keyboard.h"
+#include "key_fifo.h"
+#include "trackpad.h"
+#include "accel.h"
+#include "host_irq.h"
+#include "timebase.h"
+#include "profile.h"
+#include <string.h>
+
+/* Register flags */
+#define REG_R       0x01
+#define REG_W       0x02
+#define REG_STREAM  0x04  // read has side effects or a variable length, never auto-incremented into
+
+typedef uint8_t (*regfile_read_fn)(uint8_t reg, uint8_t *buf);  // returns the bytes written
+typedef void (*regfile_write_fn)(uint8_t reg, const uint8_t *buf);
+
+typedef struct
+{
+    uint8_t size;  // bytes per access, the largest reply for stream registers
+    uint8_t flags;
+    regfile_read_fn read;
+    regfile_write_fn write;
+} regfile_entry_t;
+
+// Register served to reads without a register write, 0 = off
+static uint8_t stream_reg = 0;
+
+// Key FIFO overflow count at the previous event burst
+static uint8_t events_overflow_seen = 0;
+
+// Write cursor, owned by the I2C receive callbacks
+static uint8_t write_reg = 0;
+static uint8_t write_off = 0;
+static uint8_t write_buf[4];
+
+static uint8_t regfile_put_be16(uint8_t *buf, uint16_t v)
+{
+    buf[0] = (v >> 8) & 0xFF;
+    buf[1] = v & 0xFF;
+    return 2;
+}
+
+static uint8_t regfile_put_be32(uint8_t *buf, uint32_t v)
+{
+    buf[0] = (v >> 24) & 0xFF;
+    buf[1] = (v >> 16) & 0xFF;
+    buf[2] = (v >> 8) & 0xFF;
+    buf[3] = v & 0xFF;
+    return 4;
+}
+
+static uint16_t regfile_get_be16(const uint8_t *buf)
+{
+    return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+/* Identification */
+static uint8_t reg_read_id(uint8_t reg, uint8_t *buf)
+{
+    uint16_t caps = REGFILE_CAP_EVENTS | REGFILE_CAP_EVENTS_TS | REGFILE_CAP_LEVEL_IRQ |
+                    REGFILE_CAP_RAW_KEYS | REGFILE_CAP_CONFIG | REGFILE_CAP_STREAM |
+                    REGFILE_CAP_BUTTONS;
+
+#if PROFILE_ENABLE
+    caps |= REGFILE_CAP_PROFILE;
+#endif
+#if I2C_SLAVE_TX_DMA
+    caps |= REGFILE_CAP_TX_DMA;
+#endif
+
+    switch (reg)
+    {
+    case ECHODEV_REG_ADDR_DEVICE_ID:
+        buf[0] = REGFILE_DEVICE_ID;
+        return 1;
+    case ECHODEV_REG_ADDR_FW_VERSION:
+        buf[0] = FIRMWARE_VERSION_MAJOR;
+        buf[1] = FIRMWARE_VERSION_MINOR;
+        return 2;
+    default:
+        return regfile_put_be16(buf, caps);
+    }
+}
+
+/* Keyboard */
+static uint8_t reg_read_key(uint8_t reg, uint8_t *buf)
+{
+    // Each read pops one key from the FIFO, 0x00 means the FIFO is empty
+    uint8_t key;
+
+    buf[0] = key_fifo_pop(&key, NULL) ? key : 0x00;
+    return 1;
+}
+
+static uint8_t reg_read_keyboard_status(uint8_t reg, uint8_t *buf)
+{
+    switch (reg)
+    {
+    case ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_COUNT:
+        buf[0] = key_fifo_count();
+        break;
+    case ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_OVERFLOW:
+        buf[0] = key_fifo_overflow_count();
+        break;
+    default:
+        buf[0] = keyboard_get_mode();
+        break;
+    }
+    return 1;
+}
+
+static void reg_write_keyboard_mode(uint8_t reg, const uint8_t *buf)
+{
+    // Keys queued in the previous mode would be misread by the host
+    keyboard_set_mode(buf[0]);
+    key_fifo_flush();
+    host_irq_update();
+}
+
+static uint8_t reg_read_keyboard_config(uint8_t reg, uint8_t *buf)
+{
+    keyboard_config_t cfg;
+
+    keyboard_get_config(&cfg);
+
+    switch (reg)
+    {
+    case ECHODEV_REG_ADDR_KEYBOARD_SCAN_RATE:
+        return regfile_put_be16(buf, cfg.scan_rate_hz);
+    case ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_PRESS:
+        buf[0] = cfg.debounce_press_ms;
+        return 1;
+    case ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_RELEASE:
+        buf[0] = cfg.debounce_release_ms;
+        return 1;
+    case ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_EAGER:
+        buf[0] = cfg.debounce_eager_press;
+        return 1;
+    case ECHODEV_REG_ADDR_KEYBOARD_HOLD_DELAY:
+        return regfile_put_be16(buf, cfg.hold_delay_ms);
+    default:
+        return regfile_put_be16(buf, cfg.repeat_interval_ms);
+    }
+}
+
+static void reg_write_keyboard_config(uint8_t reg, const uint8_t *buf)
+{
+    keyboard_config_t cfg;
+
+    keyboard_get_config(&cfg);
+
+    switch (reg)
+    {
+    case ECHODEV_REG_ADDR_KEYBOARD_SCAN_RATE:
+        cfg.scan_rate_hz = regfile_get_be16(buf);
+        break;
+    case ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_PRESS:
+        cfg.debounce_press_ms = buf[0];
+        break;
+    case ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_RELEASE:
+        cfg.debounce_release_ms = buf[0];
+        break;
+    case ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_EAGER:
+        cfg.debounce_eager_press = buf[0];
+        break;
+    case ECHODEV_REG_ADDR_KEYBOARD_HOLD_DELAY:
+        cfg.hold_delay_ms = regfile_get_be16(buf);
+        break;
+    default:
+        cfg.repeat_interval_ms = regfile_get_be16(buf);
+        break;
+    }
+
+    keyboard_set_config(&cfg);
+}
+
+/* Trackball */
+static uint8_t reg_read_trackball(uint8_t reg, uint8_t *buf)
+{
+    if (reg == ECHODEV_REG_ADDR_READ_TRACKBALL_REPORT)
+    {
+        get_i2c_trackpad_report(buf);
+        return TRACKBALL_REPORT_SIZE;
+    }
+
+    get_i2c_trackpad_txdata(buf);
+    return 4;
+}
+
+static uint8_t reg_read_trackball_format(uint8_t reg, uint8_t *buf)
+{
+    buf[0] = trackpad_get_format();
+    return 1;
+}
+
+static void reg_write_trackball_format(uint8_t reg, const uint8_t *buf)
+{
+    trackpad_set_format(buf[0]);
+}
+
+static uint8_t reg_read_trackpad_config(uint8_t reg, uint8_t *buf)
+{
+    switch (reg)
+    {
+    case ECHODEV_REG_ADDR_TRACKPAD_REPORT_RATE:
+        return regfile_put_be16(buf, trackpad_get_report_rate());
+    case ECHODEV_REG_ADDR_TRACKPAD_ACCEL_CURVE:
+        buf[0] = accel_get_curve();
+        return 1;
+    default:
+        buf[0] = trackpad_get_rgb_led();
+        return 1;
+    }
+}
+
+static void reg_write_trackpad_config(uint8_t reg, const uint8_t *buf)
+{
+    switch (reg)
+    {
+    case ECHODEV_REG_ADDR_TRACKPAD_REPORT_RATE:
+        trackpad_set_report_rate(regfile_get_be16(buf));
+        break;
+    case ECHODEV_REG_ADDR_TRACKPAD_ACCEL_CURVE:
+        if (buf[0] <= ACCEL_CURVE_LUT)
+            accel_configure((accel_curve_t)buf[0]);
+        break;
+    default:
+        if (buf[0] <= NONE)
+            trackpad_set_rgb_led((color_t)buf[0]);
+        break;
+    }
+}
+
+/* Event bursts, the pending trackball report first and then keys from the FIFO */
+static uint8_t reg_read_events(uint8_t reg, uint8_t *buf)
+{
+    // Timestamped bursts carry the device time and a time per record
+    uint8_t timestamped = (reg == ECHODEV_REG_ADDR_READ_EVENTS_TS);
+    uint8_t size = timestamped ? EVENT_TS_BURST_SIZE : EVENT_BURST_SIZE;
+    uint8_t max = timestamped ? EVENT_TS_BURST_MAX : EVENT_BURST_MAX;
+    uint8_t stride = timestamped ? EVENT_TS_RECORD_SIZE : EVENT_RECORD_SIZE;
+    uint8_t *rec = &buf[timestamped ? 5 : 1];
+    uint8_t count = 0;
+    uint8_t key;
+    int16_t dx, dy;
+    uint8_t buttons, flags;
+    uint32_t time_us;
+
+    memset(buf, 0, size);
+
+    if (timestamped)
+        regfile_put_be32(&buf[1], timebase_us());
+
+    if (trackpad_take_report(&dx, &dy, &buttons, &flags, &time_us))
+    {
+        if (flags & TRACKPAD_FLAG_BUTTONS)
+        {
+            rec[0] = EVENT_TYPE_BUTTON;
+            rec[1] = buttons;
+            rec[2] = flags;
+        }
+        else
+        {
+            rec[0] = EVENT_TYPE_MOTION;
+            rec[1] = (dx >> 8) & 0xFF;
+            rec[2] = dx & 0xFF;
+            rec[3] = (dy >> 8) & 0xFF;
+            rec[4] = dy & 0xFF;
+        }
+        if (timestamped)
+            regfile_put_be32(&rec[EVENT_RECORD_SIZE], time_us);
+        rec += stride;
+        count++;
+    }
+
+    while (count < max && key_fifo_pop(&key, &time_us))
+    {
+        rec[0] = EVENT_TYPE_KEY;
+        rec[1] = key;
+        if (timestamped)
+            regfile_put_be32(&rec[EVENT_RECORD_SIZE], time_us);
+        rec += stride;
+        count++;
+    }
+
+    buf[0] = count | (key_fifo_count() ? EVENT_HDR_MORE : 0);
+
+    // Flag new drops so the host reads the overflow counter only when it changed
+    if (key_fifo_overflow_count() != events_overflow_seen)
+    {
+        events_overflow_seen = key_fifo_overflow_count();
+        buf[0] |= EVENT_HDR_OVERFLOW;
+    }
+
+    return size;
+}
+
+static uint8_t reg_read_stream_config(uint8_t reg, uint8_t *buf)
+{
+    buf[0] = stream_reg;
+    return 1;
+}
+
+static void reg_write_stream_config(uint8_t reg, const uint8_t *buf)
+{
+    // Only registers that are read on their own make sense without a pointer
+    if (buf[0] == 0 || regfile_is_stream(buf[0]))
+        stream_reg = buf[0];
+}
+
+/* Host interrupt */
+static uint8_t reg_read_host_irq(uint8_t reg, uint8_t *buf)
+{
+    buf[0] = (reg == ECHODEV_REG_ADDR_READ_INT_STATUS) ? host_irq_status() : host_irq_get_mode();
+    return 1;
+}
+
+static void reg_write_int_config(uint8_t reg, const uint8_t *buf)
+{
+    host_irq_set_mode(buf[0]);
+}
+
+/* Timing and profiling */
+static uint8_t reg_read_device_time(uint8_t reg, uint8_t *buf)
+{
+    // Latched at the address match so the host can bracket it with its own clock
+    return regfile_put_be32(buf, timebase_us());
+}
+
+static uint8_t reg_read_profile(uint8_t reg, uint8_t *buf)
+{
+    profile_stats_t st;
+
+    profile_get((profile_probe_t)(reg - ECHODEV_REG_ADDR_READ_PROFILE), &st);
+    regfile_put_be32(&buf[0], st.count);
+    regfile_put_be32(&buf[4], st.min);
+    regfile_put_be32(&buf[8], st.max);
+    regfile_put_be32(&buf[12], st.count ? (uint32_t)(st.total / st.count) : 0);
+    return PROFILE_REG_SIZE;
+}
+
+static uint8_t reg_read_profile_info(uint8_t reg, uint8_t *buf)
+{
+    // Core clock so the host can turn cycles into time
+    regfile_put_be32(buf, SystemCoreClock);
+    buf[4] = PROFILE_PROBE_COUNT;
+    return 5;
+}
+
+/* Indexed by register address, unlisted addresses read as zero and ignore writes */
+static const regfile_entry_t regfile[256] = {
+    [ECHODEV_REG_ADDR_DEVICE_ID]                   = { 1, REG_R, reg_read_id, NULL },
+    [ECHODEV_REG_ADDR_FW_VERSION]                  = { 2, REG_R, reg_read_id, NULL },
+    [ECHODEV_REG_ADDR_CAPABILITIES]                = { 2, REG_R, reg_read_id, NULL },
+
+    [ECHODEV_REG_ADDR_READ_KEYBOARD]               = { 1, REG_R | REG_STREAM, reg_read_key, NULL },
+    [ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_COUNT]    = { 1, REG_R, reg_read_keyboard_status, NULL },
+    [ECHODEV_REG_ADDR_READ_KEYBOARD_FIFO_OVERFLOW] = { 1, REG_R, reg_read_keyboard_status, NULL },
+    [ECHODEV_REG_ADDR_KEYBOARD_MODE]               = { 1, REG_R | REG_W, reg_read_keyboard_status, reg_write_keyboard_mode },
+
+    [ECHODEV_REG_ADDR_READ_TRACKBALL]              = { 4, REG_R | REG_STREAM, reg_read_trackball, NULL },
+    [ECHODEV_REG_ADDR_READ_TRACKBALL_REPORT]       = { TRACKBALL_REPORT_SIZE, REG_R | REG_STREAM, reg_read_trackball, NULL },
+    [ECHODEV_REG_ADDR_TRACKBALL_FORMAT]            = { 1, REG_R | REG_W, reg_read_trackball_format, reg_write_trackball_format },
+
+    [ECHODEV_REG_ADDR_READ_EVENTS]                 = { EVENT_BURST_SIZE, REG_R | REG_STREAM, reg_read_events, NULL },
+    [ECHODEV_REG_ADDR_READ_EVENTS_TS]              = { EVENT_TS_BURST_SIZE, REG_R | REG_STREAM, reg_read_events, NULL },
+    [ECHODEV_REG_ADDR_STREAM_CONFIG]               = { 1, REG_R | REG_W, reg_read_stream_config, reg_write_stream_config },
+
+    [ECHODEV_REG_ADDR_READ_INT_STATUS]             = { 1, REG_R, reg_read_host_irq, NULL },
+    [ECHODEV_REG_ADDR_INT_CONFIG]                  = { 1, REG_R | REG_W, reg_read_host_irq, reg_write_int_config },
+
+    [ECHODEV_REG_ADDR_READ_DEVICE_TIME]            = { 4, REG_R, reg_read_device_time, NULL },
+
+    [ECHODEV_REG_ADDR_READ_PROFILE ...
+     ECHODEV_REG_ADDR_READ_PROFILE + PROFILE_PROBE_COUNT - 1] = { PROFILE_REG_SIZE, REG_R, reg_read_profile, NULL },
+    [ECHODEV_REG_ADDR_READ_PROFILE_INFO]           = { 5, REG_R, reg_read_profile_info, NULL },
+
+    [ECHODEV_REG_ADDR_KEYBOARD_SCAN_RATE]          = { 2, REG_R | REG_W, reg_read_keyboard_config, reg_write_keyboard_config },
+    [ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_PRESS]     = { 1, REG_R | REG_W, reg_read_keyboard_config, reg_write_keyboard_config },
+    [ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_RELEASE]   = { 1, REG_R | REG_W, reg_read_keyboard_config, reg_write_keyboard_config },
+    [ECHODEV_REG_ADDR_KEYBOARD_DEBOUNCE_EAGER]     = { 1, REG_R | REG_W, reg_read_keyboard_config, reg_write_keyboard_config },
+    [ECHODEV_REG_ADDR_KEYBOARD_HOLD_DELAY]         = { 2, REG_R | REG_W, reg_read_keyboard_config, reg_write_keyboard_config },
+    [ECHODEV_REG_ADDR_KEYBOARD_REPEAT_INTERVAL]    = { 2, REG_R | REG_W, reg_read_keyboard_config, reg_write_keyboard_config },
+    [ECHODEV_REG_ADDR_TRACKPAD_REPORT_RATE]        = { 2, REG_R | REG_W, reg_read_trackpad_config, reg_write_trackpad_config },
+    [ECHODEV_REG_ADDR_TRACKPAD_ACCEL_CURVE]        = { 1, REG_R | REG_W, reg_read_trackpad_config, reg_write_trackpad_config },
+    [ECHODEV_REG_ADDR_TRACKPAD_LED]                = { 1, REG_R | REG_W, reg_read_trackpad_config, reg_write_trackpad_config },
+};
+
+// Fills buf with the register at reg alone, returns its length or 0 if it cannot be read.
+// The I2C slave asks for the next register only once the host clocks past this one.
+uint8_t regfile_read(uint8_t reg, uint8_t *buf)
+{
+    const regfile_entry_t *e = &regfile[reg];
+
+    if (!(e->flags & REG_R))
+        return 0;
+
+    return e->read(reg, buf);
+}
+
+// Auto-increment runs through plain registers only, it stops before a stream register
+uint8_t regfile_is_plain(uint8_t reg)
+{
+    return (regfile[reg].flags & (REG_R | REG_STREAM)) == REG_R;
+}
+
+uint8_t regfile_is_stream(uint8_t reg)
+{
+    return (regfile[reg].flags & REG_STREAM) != 0;
+}
+
+uint8_t regfile_get_stream_reg(void)
+{
+    return stream_reg;
+}
+
+void regfile_write_start(uint8_t reg)
+{
+    write_reg = reg;
+    write_off = 0;
+}
+
+void regfile_write_byte(uint8_t byte)
+{
+    const regfile_entry_t *e = &regfile[write_reg];
+
+    // Bytes past the writable run are dropped
+    if (!(e->flags & REG_W))
+        return;
+
+    write_buf[write_off++] = byte;
+    if (write_off < e->size)
+        return;
+
+    e->write(write_reg, write_buf);
+    write_reg++;
+    write_off = 0;
+}
@@ -0,0 +1,43 @@
+/**
+ * Blackberry Q10 keyboard + Blackberry Trackball 303TRACKBA1 STM32 driver
+ * Copyright (C) 2025 Mustafa Ozcelikors
+ *
+ * See GPLv3 LICENSE file in repository for licensing details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "timebase.h"
+
+uint32_t timebase_apb1_timer_clock(void)
+{
+    // APB1 timer clocks run at twice PCLK1 whenever the APB1 prescaler is not 1
+    uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1)
+        return pclk1 * 2;
+
+    return pclk1;
+}
+
+void timebase_init(void)
+{
+    __HAL_RCC_TIM5_CLK_ENABLE();
+
+    TIMEBASE_TIMER->CR1 = 0;
+    TIMEBASE_TIMER->PSC = timebase_apb1_timer_clock() / 1000000 - 1;
+    TIMEBASE_TIMER->ARR = 0xFFFFFFFF;
+    TIMEBASE_TIMER->EGR = TIM_EGR_UG;
+    TIMEBASE_TIMER->CR1 = TIM_CR1_CEN;
+}
@@ -19,10 +19,23 @@
  */
 
 #include "trackpad.h"
+#include "accel.h"
+#include "timebase.h"
+#include "i2c_slave.h"
+#include "host_irq.h"
+#include "profile.h"
 
 #define TRACKPAD_PIN_COUNT 9
 #define TRACKPAD_STEP 10
 
+/* Report scheduler, TIM4 ticks at 1 MHz and overflows once per report period */
+#define REPORT_TIMER          TIM4
+#define REPORT_TIMER_IRQn     TIM4_IRQn
+#define REPORT_TIMER_TICK_HZ  1000000
+
+/* Input filter for the pulse counters, 8 timer clocks (0.5 us at 16 MHz) */
+#define TRACKPAD_COUNTER_FILTER 0x3
+
 typedef enum {
     TP_BLU,
     TP_RED,
@@ -58,21 +71,74 @@ const uint16_t   trackpad_irq_pin  = GPIO_PIN_12;
 
 volatile int16_t trackpad_x = 0;
 volatile int16_t trackpad_y = 0;
-volatile uint8_t trackpad_btn = 0;
-uint32_t last_btn_tick = 0;
-float x_accel_factor = 1.0;
-float y_accel_factor = 1.0;
-
-// Read deltas + button, resets accumulators
+volatile uint8_t trackpad_btn = 0;  // debounced button bitmap
+// Edges since the last report tick, so a short press or release between reports is not lost
+static uint8_t trackpad_btn_down = 0;
+static uint8_t trackpad_btn_up = 0;
+// timebase_us() of the first pulse since the deltas were last taken and of the latest button edge
+static volatile uint32_t trackpad_motion_us = 0;
+static volatile uint8_t trackpad_motion_latched = 0;
+static volatile uint32_t trackpad_btn_us = 0;
+static uint32_t last_btn_us = 0;
+static accel_axis_t accel_x;
+static accel_axis_t accel_y;
+
+// Report scheduler state, owned by the report timer ISR
+static volatile uint8_t trackpad_report_pending = 0;
+static uint16_t trackpad_report_rate = TRACKPAD_REPORT_RATE_HZ;
+static color_t trackpad_led_color = ALL;
+static uint16_t trackpad_report_age = 0;
+static int32_t report_dx = 0;
+static int32_t report_dy = 0;
+static uint32_t report_motion_us = 0;  // first pulse of the coalesced report motion
+static uint8_t report_buttons = 0;  // button bitmap of the latest report
+static uint8_t report_flags = 0;
+static uint8_t trackpad_format = TRACKPAD_FORMAT_CLICK;
+static int16_t pending_dx = 0;
+static int16_t pending_dy = 0;
+static uint8_t pending_buttons = 0;
+static uint8_t pending_flags = 0;
+static uint32_t pending_us = 0;
+
+#if TRACKPAD_CAPTURE_MODE == TRACKPAD_CAPTURE_TIMER
+static uint32_t last_lft_count = 0;
+static uint16_t last_rht_count = 0;
+
+static void trackpad_sample_counters(void);
+#endif
+
+// Read deltas and the button bitmap to report next, resets the accumulators.
+// Latched edges come out one per call in order, a press before its release and the
+// release of a held button before the next press.
 void trackpad_get_deltas(int16_t *dx, int16_t *dy, uint8_t *btn)
 {
     __disable_irq();
+#if TRACKPAD_CAPTURE_MODE == TRACKPAD_CAPTURE_TIMER
+    trackpad_sample_counters();
+#endif
     *dx = trackpad_x;
     *dy = trackpad_y;
-    *btn = trackpad_btn;
     trackpad_x = 0;
     trackpad_y = 0;
-    trackpad_btn = 0;
+
+    // A report is stamped with its first pulse, later batches coalesced into it keep that time
+    if (trackpad_motion_latched)
+    {
+        if (!report_dx && !report_dy)
+            report_motion_us = trackpad_motion_us;
+        trackpad_motion_latched = 0;
+    }
+
+    if (report_buttons & trackpad_btn_up)
+    {
+        *btn = report_buttons & ~trackpad_btn_up;
+        trackpad_btn_up = 0;
+    }
+    else
+    {
+        *btn = trackpad_btn | trackpad_btn_down;
+        trackpad_btn_down = 0;
+    }
     __enable_irq();
 }
 
@@ -85,14 +151,19 @@ void trackpad_init_exti(void)
 	__HAL_RCC_GPIOC_CLK_ENABLE();
 
     // Configure trackball movement pins and BTN as EXTI
+#if TRACKPAD_CAPTURE_MODE == TRACKPAD_CAPTURE_TIMER
+    TrackpadPinName exti_pins[] = { TP_UP, TP_DWN, TP_BTN };
+#else
     TrackpadPinName exti_pins[] = { TP_UP, TP_DWN, TP_LFT, TP_RHT, TP_BTN };
+#endif
     int exti_count = sizeof(exti_pins)/sizeof(exti_pins[0]);
 
     for(int i = 0; i < exti_count; i++)
     {
         TrackpadPinName name = exti_pins[i];
         GPIO_InitStruct.Pin = trackpad_pins[name];
-        GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+        // The button reports both edges, press and release
+        GPIO_InitStruct.Mode = (name == TP_BTN) ? GPIO_MODE_IT_RISING_FALLING : GPIO_MODE_IT_FALLING;
         GPIO_InitStruct.Pull = GPIO_PULLUP;
         HAL_GPIO_Init(trackpad_ports[name], &GPIO_InitStruct);
 
@@ -127,10 +198,57 @@ void trackpad_init_exti(void)
     }
 }
 
+#if TRACKPAD_CAPTURE_MODE == TRACKPAD_CAPTURE_TIMER
+static void trackpad_init_counters(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    __HAL_RCC_TIM1_CLK_ENABLE();
+    __HAL_RCC_TIM2_CLK_ENABLE();
+
+    // LFT (PA15) -> TIM2_ETR, RHT (PA9) -> TIM1_CH2
+    GPIO_InitStruct.Pin = trackpad_pins[TP_LFT];
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    GPIO_InitStruct.Alternate = GPIO_AF1_TIM2;
+    HAL_GPIO_Init(trackpad_ports[TP_LFT], &GPIO_InitStruct);
+
+    GPIO_InitStruct.Pin = trackpad_pins[TP_RHT];
+    GPIO_InitStruct.Alternate = GPIO_AF1_TIM1;
+    HAL_GPIO_Init(trackpad_ports[TP_RHT], &GPIO_InitStruct);
+
+    // TIM2: external clock mode 2, counts falling edges on ETR
+    TIM2->CR1  = 0;
+    TIM2->PSC  = 0;
+    TIM2->ARR  = 0xFFFFFFFF;
+    TIM2->SMCR = TIM_SMCR_ECE | TIM_SMCR_ETP | (TRACKPAD_COUNTER_FILTER << TIM_SMCR_ETF_Pos);
+    TIM2->EGR  = TIM_EGR_UG;
+    TIM2->CR1  = TIM_CR1_CEN;
+
+    // TIM1: external clock mode 1, counts falling edges on TI2FP2
+    TIM1->CR1   = 0;
+    TIM1->PSC   = 0;
+    TIM1->ARR   = 0xFFFF;
+    TIM1->CCMR1 = TIM_CCMR1_CC2S_0 | (TRACKPAD_COUNTER_FILTER << TIM_CCMR1_IC2F_Pos);
+    TIM1->CCER  = TIM_CCER_CC2P;
+    TIM1->SMCR  = TIM_SMCR_TS_2 | TIM_SMCR_TS_1 | TIM_SMCR_SMS_2 | TIM_SMCR_SMS_1 | TIM_SMCR_SMS_0;
+    TIM1->EGR   = TIM_EGR_UG;
+    TIM1->CR1   = TIM_CR1_CEN;
+
+    last_lft_count = TIM2->CNT;
+    last_rht_count = TIM1->CNT;
+}
+#endif
+
 void trackpad_init(void)
 {
 	GPIO_InitTypeDef GPIO_InitStruct = {0};
 
+	accel_configure(TRACKPAD_ACCEL_CURVE);
+	accel_x.last_us = accel_y.last_us = timebase_us();
+
 	__HAL_RCC_GPIOA_CLK_ENABLE();
 	__HAL_RCC_GPIOB_CLK_ENABLE();
 	__HAL_RCC_GPIOC_CLK_ENABLE();
@@ -144,6 +262,9 @@ void trackpad_init(void)
 	}
 
 	trackpad_init_exti();
+#if TRACKPAD_CAPTURE_MODE == TRACKPAD_CAPTURE_TIMER
+	trackpad_init_counters();
+#endif
 
 	trackpad_set_rgb_led (ALL);
 
@@ -154,10 +275,50 @@ void trackpad_init(void)
 	GPIO_InitStruct.Pin = trackpad_irq_pin;
 	HAL_GPIO_Init(trackpad_irq_port, &GPIO_InitStruct);
 	HAL_GPIO_WritePin(trackpad_irq_port, trackpad_irq_pin, GPIO_PIN_RESET);
+
+	// Start publishing reports at a fixed rate
+	trackpad_report_timer_init();
+}
+
+void trackpad_report_timer_init(void)
+{
+    __HAL_RCC_TIM4_CLK_ENABLE();
+
+    // Update event publishes a report, compare channel 1 ends the IRQ pulse
+    REPORT_TIMER->CR1  = 0;
+    REPORT_TIMER->PSC  = timebase_apb1_timer_clock() / REPORT_TIMER_TICK_HZ - 1;
+    REPORT_TIMER->ARR  = REPORT_TIMER_TICK_HZ / trackpad_report_rate - 1;
+    REPORT_TIMER->CCR1 = TRACKPAD_IRQ_PULSE_US;
+    REPORT_TIMER->EGR  = TIM_EGR_UG;
+    REPORT_TIMER->SR   = 0;
+    REPORT_TIMER->DIER = TIM_DIER_UIE;
+
+    // Same priority as the keyboard scan, below I2C and the trackball EXTIs
+    HAL_NVIC_SetPriority(REPORT_TIMER_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(REPORT_TIMER_IRQn);
+
+    // ARR is preloaded, a rate change takes effect at the next report without an extra one
+    REPORT_TIMER->CR1 = TIM_CR1_ARPE | TIM_CR1_CEN;
+}
+
+void trackpad_set_report_rate(uint16_t rate_hz)
+{
+    if (rate_hz != 125 && rate_hz != 250 && rate_hz != 500 && rate_hz != 1000)
+        return;
+
+    trackpad_report_rate = rate_hz;
+    REPORT_TIMER->ARR = REPORT_TIMER_TICK_HZ / rate_hz - 1;
+}
+
+uint16_t trackpad_get_report_rate(void)
+{
+    return trackpad_report_rate;
 }
 
 void trackpad_set_rgb_led (color_t color)
 {
+	trackpad_led_color = (color > NONE) ? ALL : color;
+
 	switch(color)
 	{
 	case WHITE:
@@ -199,74 +360,236 @@ void trackpad_set_rgb_led (color_t color)
 	}
 }
 
-static uint8_t absvalue (int8_t val)
+color_t trackpad_get_rgb_led(void)
+{
+	return trackpad_led_color;
+}
+
+// Debounced button sampling, from the EXTI on an edge and from the report tick in case
+// the last edge fell inside the debounce window. Interrupts must be disabled or masked.
+static void trackpad_update_button(uint32_t now)
 {
-	if (val < 0) val*=-1;
-	return val;
+    uint8_t btn;
+
+    if ((now - last_btn_us) < TRACKPAD_BTN_DEBOUNCE_MS * 1000)
+        return;
+
+    // Active-low
+    btn = (HAL_GPIO_ReadPin(trackpad_ports[TP_BTN], trackpad_pins[TP_BTN]) == GPIO_PIN_RESET) ?
+          TRACKPAD_BUTTON_LEFT : 0;
+    if (btn == trackpad_btn)
+        return;
+
+    trackpad_btn_down |= btn & ~trackpad_btn;
+    trackpad_btn_up |= trackpad_btn & ~btn;
+    trackpad_btn = btn;
+    trackpad_btn_us = now;
+    last_btn_us = now;
 }
 
-static float get_accel_factor(uint8_t step)
+static void trackpad_latch_motion(uint32_t now)
 {
-	float accel_factor = 1.0;
-
-	if (absvalue(step) >= TRACKPAD_STEP*7)
-		accel_factor = 7.0;
-	else if (absvalue(step) >= TRACKPAD_STEP*5)
-		accel_factor = 5.0;
-	else if(absvalue(step) >= TRACKPAD_STEP*3)
-		accel_factor = 3.0;
-	else if(absvalue(step) >= TRACKPAD_STEP*2)
-		accel_factor = 2.0;
-	else if (absvalue(step) >= TRACKPAD_STEP)
-		accel_factor = 1.3;
-	else
-		accel_factor = 1.0;
-
-	return accel_factor;
+    if (!trackpad_motion_latched)
+    {
+        trackpad_motion_us = now;
+        trackpad_motion_latched = 1;
+    }
 }
 
 void trackpad_update_pin(TrackpadPinName pin_name)
 {
-	float accel_factor_x = get_accel_factor(trackpad_x);
-	float accel_factor_y = get_accel_factor(trackpad_y);
+    uint32_t now = timebase_us();
 
     switch(pin_name)
     {
         case TP_LFT:
-            trackpad_x += (int16_t)(TRACKPAD_STEP * accel_factor_x);
+            trackpad_x += accel_apply(&accel_x, 1, TRACKPAD_STEP, now);
+            trackpad_latch_motion(now);
             break;
         case TP_RHT:
-            trackpad_x -= (int16_t)(TRACKPAD_STEP * accel_factor_x);
+            trackpad_x += accel_apply(&accel_x, -1, TRACKPAD_STEP, now);
+            trackpad_latch_motion(now);
             break;
         case TP_UP:
-            trackpad_y += (int16_t)(TRACKPAD_STEP * accel_factor_y);
+            trackpad_y += accel_apply(&accel_y, 1, TRACKPAD_STEP, now);
+            trackpad_latch_motion(now);
             break;
         case TP_DWN:
-            trackpad_y -= (int16_t)(TRACKPAD_STEP * accel_factor_y);
+            trackpad_y += accel_apply(&accel_y, -1, TRACKPAD_STEP, now);
+            trackpad_latch_motion(now);
             break;
         case TP_BTN:
-        {
-            uint32_t t = HAL_GetTick();
-            if((t - last_btn_tick) >= TRACKPAD_BTN_DEBOUNCE_MS)
-            {
-                last_btn_tick = t;
-                GPIO_PinState state = HAL_GPIO_ReadPin(trackpad_ports[TP_BTN], trackpad_pins[TP_BTN]);
-                trackpad_btn = (state == GPIO_PIN_RESET); // active-low
-            }
+            trackpad_update_button(now);
             break;
-        }
         default:
             // LEDs: TP_BLU, TP_RED, TP_GRN, TP_WHT – ignore here
             break;
     }
 }
 
+#if TRACKPAD_CAPTURE_MODE == TRACKPAD_CAPTURE_TIMER
+// Fold the pulses counted in hardware since the last sample into the X accumulator
+static void trackpad_sample_counters(void)
+{
+    uint32_t lft_count = TIM2->CNT;
+    uint16_t rht_count = TIM1->CNT;
+    int32_t pulses = (int32_t)(lft_count - last_lft_count) - (int32_t)(uint16_t)(rht_count - last_rht_count);
+
+    last_lft_count = lft_count;
+    last_rht_count = rht_count;
+
+    // Velocity is the pulse count over the time since the previous sample
+    uint32_t now = timebase_us();
+
+    trackpad_x += accel_apply(&accel_x, pulses, TRACKPAD_STEP, now);
+    if (pulses)
+        trackpad_latch_motion(now);
+}
+#endif
+
 void trackpad_generate_irq_pulse(void)
 {
-	// Pulse on interrupt output pin TRACKPAD_CHANGED_IRQ
+	// Level mode signals through the shared line instead
+	if (host_irq_get_mode() == HOST_IRQ_MODE_LEVEL)
+	{
+		host_irq_update();
+		return;
+	}
+
+	// Pulse on interrupt output pin TRACKPAD_CHANGED_IRQ, the report timer compare ends it
+	REPORT_TIMER->SR = ~TIM_SR_CC1IF;
+	REPORT_TIMER->DIER |= TIM_DIER_CC1IE;
 	HAL_GPIO_WritePin(trackpad_irq_port, trackpad_irq_pin, GPIO_PIN_SET);
-	HAL_Delay(1);
-	HAL_GPIO_WritePin(trackpad_irq_port, trackpad_irq_pin, GPIO_PIN_RESET);
+}
+
+// Called by the I2C slave once the host has fetched the published report
+void trackpad_report_consumed(void)
+{
+    trackpad_report_pending = 0;
+}
+
+uint8_t trackpad_report_is_pending(void)
+{
+    return trackpad_report_pending;
+}
+
+// I2C ISR side, hands out the pending report (if any) and marks it fetched
+uint8_t trackpad_take_report(int16_t *dx, int16_t *dy, uint8_t *buttons, uint8_t *flags, uint32_t *time_us)
+{
+    if (!trackpad_report_pending)
+        return 0;
+
+    *dx = pending_dx;
+    *dy = pending_dy;
+    *buttons = pending_buttons;
+    *flags = pending_flags;
+    *time_us = pending_us;
+    trackpad_report_pending = 0;
+
+    return 1;
+}
+
+void trackpad_set_format(uint8_t format)
+{
+    if (format <= TRACKPAD_FORMAT_BUTTONS)
+        trackpad_format = format;
+}
+
+uint8_t trackpad_get_format(void)
+{
+    return trackpad_format;
+}
+
+static int16_t trackpad_clamp16(int32_t v)
+{
+    if (v > INT16_MAX || v < -INT16_MAX)
+        report_flags |= TRACKPAD_FLAG_CLAMPED;
+    if (v > INT16_MAX)
+        return INT16_MAX;
+    if (v < -INT16_MAX)
+        return -INT16_MAX;
+    return (int16_t)v;
+}
+
+static void trackpad_report_tick(void)
+{
+    int16_t dx, dy;
+    uint8_t btn;
+
+    if (trackpad_report_pending)
+    {
+        // Host has not fetched the last report yet, keep coalescing and nudge it now and then
+        if (++trackpad_report_age >= (uint32_t)TRACKPAD_IRQ_RETRIGGER_MS * trackpad_report_rate / 1000)
+        {
+            trackpad_report_age = 0;
+            trackpad_generate_irq_pulse();
+        }
+        return;
+    }
+
+    __disable_irq();
+    trackpad_update_button(timebase_us());
+    __enable_irq();
+
+    trackpad_get_deltas(&dx, &dy, &btn);
+    report_dx = trackpad_clamp16(report_dx + dx);
+    report_dy = trackpad_clamp16(report_dy + dy);
+
+    __disable_irq();
+    if (btn != report_buttons &&
+        ((btn & ~report_buttons) || trackpad_format == TRACKPAD_FORMAT_BUTTONS))
+    {
+        // A button edge takes this report slot, motion goes out in the next one.
+        // The click format has no release, it is only folded into report_buttons.
+        report_buttons = btn;
+        set_i2c_trackpad_txdata(0, 0, btn, TRACKPAD_FLAG_BUTTONS);
+        pending_dx = 0;
+        pending_dy = 0;
+        pending_buttons = btn;
+        pending_flags = TRACKPAD_FLAG_BUTTONS;
+        pending_us = trackpad_btn_us;
+    }
+    else if (report_dx || report_dy)
+    {
+        report_buttons = btn;
+        set_i2c_trackpad_txdata(report_dx, report_dy, btn, report_flags);
+        pending_dx = report_dx;
+        pending_dy = report_dy;
+        pending_buttons = btn;
+        pending_flags = report_flags;
+        pending_us = report_motion_us;
+        report_dx = 0;
+        report_dy = 0;
+        report_flags = 0;
+    }
+    else
+    {
+        // No motion, no report
+        report_buttons = btn;
+        __enable_irq();
+        return;
+    }
+    trackpad_report_pending = 1;
+    __enable_irq();
+
+    trackpad_report_age = 0;
+    trackpad_generate_irq_pulse();
+}
+
+void TIM4_IRQHandler(void)
+{
+    PROFILE_SCOPE(PROFILE_REPORT_ISR);
+    uint32_t sr = REPORT_TIMER->SR;
+    REPORT_TIMER->SR = ~(sr & (TIM_SR_UIF | TIM_SR_CC1IF));
+
+    if ((sr & TIM_SR_CC1IF) && (REPORT_TIMER->DIER & TIM_DIER_CC1IE))
+    {
+        REPORT_TIMER->DIER &= ~TIM_DIER_CC1IE;
+        HAL_GPIO_WritePin(trackpad_irq_port, trackpad_irq_pin, GPIO_PIN_RESET);
+    }
+
+    if (sr & TIM_SR_UIF)
+        trackpad_report_tick();
 }
 
 void trackpad_exti_callback(uint16_t GPIO_Pin)
@@ -288,6 +611,7 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 
 void EXTI15_10_IRQHandler(void)
 {
+    PROFILE_SCOPE(PROFILE_TRACKPAD_EXTI);
     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_10) != RESET) HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_10);
     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_11) != RESET) HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_11);
     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_12) != RESET) HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_12);
@@ -298,6 +622,7 @@ void EXTI15_10_IRQHandler(void)
 
 void EXTI9_5_IRQHandler(void)
 {
+    PROFILE_SCOPE(PROFILE_TRACKPAD_EXTI);
     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_5) != RESET) HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_5);
     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_6) != RESET) HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_6);
     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_7) != RESET) HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_7);